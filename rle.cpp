@@ -7,21 +7,37 @@
  * Key fixes:
  *   - Do not fclose(fp) in rle_read; caller owns FILE* (prevents double free).
  *   - Uses rle.hpp MAX_* limits and hardened decoder.
+ *   - rle_read decodes straight into the icv double buffer.
  *   - Background detection bounded and early-exiting.
  *   - Deterministic comments (timestamp/software/format).
  */
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <string>
-#include <unordered_map>
 #include <algorithm>
 #include <cmath>
 #include <cstdarg>
 
 
 #include "rle.hpp"   /* rle */
+#include "rle_internal.hpp"
+
+/* x86 builds without -mavx2 still carry an AVX2 quantizer, picked at run
+ * time when the CPU supports it. */
+#if defined(RLE_HAVE_SSE2) && !defined(RLE_HAVE_AVX2) && \
+    (defined(__GNUC__) || defined(_MSC_VER)) && \
+    (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+  #define RLE_ICV_AVX2_DISPATCH 1
+  #include <immintrin.h>
+  #if defined(_MSC_VER)
+    #define RLE_ICV_TARGET_AVX2
+  #else
+    #define RLE_ICV_TARGET_AVX2 __attribute__((target("avx2")))
+  #endif
+#endif
 
 void *
 bu_calloc(size_t nelem, size_t elsize, const char *)
@@ -29,6 +45,12 @@ bu_calloc(size_t nelem, size_t elsize, const char *)
     return calloc(nelem, elsize);
 }
 
+void *
+bu_malloc(size_t size, const char *)
+{
+    return malloc(size ? size : 1);
+}
+
 #define BU_ALLOC(_ptr, _type) _ptr = (_type *)bu_calloc(1, sizeof(_type), #_type " (BU_ALLOC) ")
 
 void
@@ -94,6 +116,133 @@ inline uint8_t dbl_to_u8(double v) {
 }
 inline double u8_to_dbl(uint8_t v) { return double(v) / 255.0; }
 
+/* u8_to_dbl for every byte value, so expanding a buffer is one L1 load per
+ * value instead of a division; the entries are the same doubles. */
+struct U8ToDblTable {
+    double v[256];
+    U8ToDblTable() { for (int i = 0; i < 256; ++i) v[i] = u8_to_dbl(uint8_t(i)); }
+};
+
+inline const double *u8_to_dbl_table() {
+    static const U8ToDblTable table;
+    return table.v;
+}
+
+/* Contiguous expansions of at least this many values (32 MiB of doubles)
+ * are written with non-temporal stores: the output cannot stay cached
+ * anyway, and skipping the read-for-ownership of every destination line
+ * halves the memory traffic.  Below it, plain stores win. */
+constexpr size_t EXPAND_STREAM_MIN = size_t(4) << 20;
+
+#if defined(RLE_HAVE_SSE2)
+void expand_stream_sse2(const uint8_t *src, double *dst, size_t n) {
+    const double *lut = u8_to_dbl_table();
+    size_t i = 0;
+    for (; i < n && (reinterpret_cast<uintptr_t>(dst + i) & 15); ++i) dst[i] = lut[src[i]];
+    for (; i + 4 <= n; i += 4) {
+        _mm_stream_pd(dst + i, _mm_set_pd(lut[src[i + 1]], lut[src[i]]));
+        _mm_stream_pd(dst + i + 2, _mm_set_pd(lut[src[i + 3]], lut[src[i + 2]]));
+    }
+    _mm_sfence();
+    for (; i < n; ++i) dst[i] = lut[src[i]];
+}
+#endif
+
+/* dst[i * stride] = u8_to_dbl(src[i]) for n values. */
+void expand_u8(const uint8_t *src, double *dst, size_t n, size_t stride) {
+#if defined(RLE_HAVE_SSE2)
+    if (stride == 1 && n >= EXPAND_STREAM_MIN) {
+        expand_stream_sse2(src, dst, n);
+        return;
+    }
+#endif
+    const double *lut = u8_to_dbl_table();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, dst += 4 * stride) {
+        dst[0]          = lut[src[i + 0]];
+        dst[stride]     = lut[src[i + 1]];
+        dst[2 * stride] = lut[src[i + 2]];
+        dst[3 * stride] = lut[src[i + 3]];
+    }
+    for (; i < n; ++i, dst += stride) *dst = lut[src[i]];
+}
+
+/* dst[i] = dbl_to_u8(src[i]) for n values, bit-exact: the vector paths
+ * clamp with max-then-min (which also maps NaN to 0, as lrint's x86
+ * out-of-range result does after truncation to 8 bits), scale, and round
+ * with cvtpd2dq under the same MXCSR mode lrint uses, then narrow with
+ * saturating packs.  16 values per step. */
+#if defined(RLE_HAVE_SSE2) && !defined(RLE_HAVE_AVX2)
+inline __m128i quantize2_sse2(const double *p) {
+    __m128d v = _mm_min_pd(_mm_max_pd(_mm_loadu_pd(p), _mm_setzero_pd()), _mm_set1_pd(1.0));
+    return _mm_cvtpd_epi32(_mm_mul_pd(v, _mm_set1_pd(255.0)));
+}
+
+void quantize_sse2(const double *src, uint8_t *dst, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i q[4];
+        for (int j = 0; j < 4; ++j)
+            q[j] = _mm_unpacklo_epi64(quantize2_sse2(src + i + 4 * j), quantize2_sse2(src + i + 4 * j + 2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+    }
+    for (; i < n; ++i) dst[i] = dbl_to_u8(src[i]);
+}
+#endif
+
+#if defined(RLE_HAVE_AVX2) || defined(RLE_ICV_AVX2_DISPATCH)
+#ifndef RLE_ICV_TARGET_AVX2
+  #define RLE_ICV_TARGET_AVX2
+#endif
+RLE_ICV_TARGET_AVX2
+void quantize_avx2(const double *src, uint8_t *dst, size_t n) {
+    const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0), scale = _mm256_set1_pd(255.0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i q[4];
+        for (int j = 0; j < 4; ++j) {
+            __m256d v = _mm256_min_pd(_mm256_max_pd(_mm256_loadu_pd(src + i + 4 * j), zero), one);
+            q[j] = _mm256_cvtpd_epi32(_mm256_mul_pd(v, scale));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+    }
+    for (; i < n; ++i) dst[i] = dbl_to_u8(src[i]);
+}
+#endif
+
+#ifdef RLE_ICV_AVX2_DISPATCH
+bool cpu_has_avx2() {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7) return false;
+    __cpuid(r, 1);
+    const int osxsave_avx = (1 << 27) | (1 << 28);
+    if ((r[2] & osxsave_avx) != osxsave_avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif
+
+void quantize_u8(const double *src, uint8_t *dst, size_t n) {
+#if defined(RLE_HAVE_AVX2)
+    quantize_avx2(src, dst, n);
+#elif defined(RLE_ICV_AVX2_DISPATCH)
+    static void (*const kernel)(const double *, uint8_t *, size_t) =
+        cpu_has_avx2() ? quantize_avx2 : quantize_sse2;
+    kernel(src, dst, n);
+#elif defined(RLE_HAVE_SSE2)
+    quantize_sse2(src, dst, n);
+#else
+    for (size_t i = 0; i < n; ++i) dst[i] = dbl_to_u8(src[i]);
+#endif
+}
+
 bool icv_to_u8_interleaved(const icv_image_t *img, std::vector<uint8_t> &buf, bool &has_alpha) {
     if (!img || !img->data || img->channels < 3) return false;
     uint64_t npix;
@@ -110,107 +259,162 @@ bool icv_to_u8_interleaved(const icv_image_t *img, std::vector<uint8_t> &buf, bo
     try { buf.resize(static_cast<size_t>(npix) * channels_out); }
     catch (...) { return false; }
 
-    const double *src = img->data;
-    if (has_alpha) {
-        // Convert RGBA
-        for (uint64_t i = 0; i < npix; ++i) {
-            buf[4*i + 0] = dbl_to_u8(src[4*i + 0]);  // R
-            buf[4*i + 1] = dbl_to_u8(src[4*i + 1]);  // G
-            buf[4*i + 2] = dbl_to_u8(src[4*i + 2]);  // B
-            buf[4*i + 3] = dbl_to_u8(src[4*i + 3]);  // A
-        }
-    } else {
-        // Convert RGB
-        for (uint64_t i = 0; i < npix; ++i) {
-            buf[3*i + 0] = dbl_to_u8(src[3*i + 0]);  // R
-            buf[3*i + 1] = dbl_to_u8(src[3*i + 1]);  // G
-            buf[3*i + 2] = dbl_to_u8(src[3*i + 2]);  // B
-        }
-    }
+    // RGB and RGBA both read the first npix * channels_out doubles in order
+    quantize_u8(img->data, buf.data(), static_cast<size_t>(npix) * channels_out);
     return true;
 }
 
-bool u8_interleaved_to_icv(const std::vector<uint8_t> &buf, size_t w, size_t h, bool has_alpha, icv_image_t *out) {
-    if (!out || !w || !h) return false;
-    uint64_t npix;
-    if (!safe_mul_u64(w, h, rle::MAX_PIXELS, npix)) return false;
-    
-    size_t channels = has_alpha ? 4 : 3;
-    if (buf.size() < npix * channels) return false;
+/* rle::Decoder sink writing normalised doubles straight into a bu_malloc'd
+ * icv buffer: colour channels 0-2 and alpha fill an RGB or RGBA pixel,
+ * colour channels past the third are dropped and ones the file lacks stay
+ * 0.  Rows are initialised (background, opaque alpha) just before the
+ * decoder first writes or finishes them, so each row is touched while it
+ * is still in cache. */
+struct IcvSink {
+    double *data;
+    size_t chans;           /* 3 or 4 */
+    size_t row_elems;
+    size_t height;
+    size_t filled;          /* rows below this are initialised */
+    int ncolors;
+    std::vector<double> blank;
+
+    IcvSink() : data(NULL), chans(0), row_elems(0), height(0), filled(0), ncolors(0) {}
+
+    bool begin(const rle::Header &h) {
+        chans = h.has_alpha() ? 4 : 3;
+        ncolors = h.ncolors;
+        height = h.height();
+        uint64_t npix, elems;
+        if (!safe_mul_u64(h.width(), h.height(), rle::MAX_PIXELS, npix)) return false;
+        if (!safe_mul_u64(npix, chans, rle::MAX_ALLOC_BYTES / sizeof(double), elems)) return false;
+        row_elems = size_t(h.width()) * chans;
+
+        const double *lut = u8_to_dbl_table();
+        try { blank.assign(row_elems, 0.0); }
+        catch (...) { return false; }
+        for (size_t i = 0; i < row_elems; i += chans) {
+            if (!h.no_background())
+                for (size_t c = 0; c < 3 && c < h.ncolors && c < h.background.size(); ++c)
+                    blank[i + c] = lut[h.background[c]];
+            if (chans == 4) blank[i + 3] = 1.0;
+        }
+
+        data = static_cast<double *>(bu_malloc(static_cast<size_t>(elems) * sizeof(double), "rle_icv_data"));
+        return data != NULL;
+    }
 
-    uint64_t elems;
-    if (!safe_mul_u64(npix, channels, rle::MAX_ALLOC_BYTES / sizeof(double), elems)) return false;
+    void fill_to(size_t y_end) {
+        if (y_end > height) y_end = height;
+        for (; filled < y_end; ++filled)
+            memcpy(data + filled * row_elems, blank.data(), row_elems * sizeof(double));
+    }
 
-    double *data = static_cast<double *>(
-        bu_calloc(static_cast<size_t>(npix) * channels, sizeof(double), "rle_icv_data"));
-    if (!data) return false;
+    /* Element for (y, x) in decoder channel ch, or NULL to drop it */
+    double *at(uint32_t y, uint32_t x, int ch) {
+        size_t c;
+        if (ch == ncolors) c = 3;           /* alpha; only passed when present */
+        else if (ch < 3) c = size_t(ch);
+        else return NULL;
+        fill_to(size_t(y) + 1);
+        return data + y * row_elems + size_t(x) * chans + c;
+    }
 
-    if (has_alpha) {
-        // Convert RGBA
-        for (uint64_t i = 0; i < npix; ++i) {
-            data[4*i + 0] = u8_to_dbl(buf[4*i + 0]);  // R
-            data[4*i + 1] = u8_to_dbl(buf[4*i + 1]);  // G
-            data[4*i + 2] = u8_to_dbl(buf[4*i + 2]);  // B
-            data[4*i + 3] = u8_to_dbl(buf[4*i + 3]);  // A
-        }
-    } else {
-        // Convert RGB
-        for (uint64_t i = 0; i < npix; ++i) {
-            data[3*i + 0] = u8_to_dbl(buf[3*i + 0]);  // R
-            data[3*i + 1] = u8_to_dbl(buf[3*i + 1]);  // G
-            data[3*i + 2] = u8_to_dbl(buf[3*i + 2]);  // B
+    void run(uint32_t y, uint32_t x, int ch, uint8_t v, uint32_t n) {
+        double *d = at(y, x, ch);
+        if (!d) return;
+        const double dv = u8_to_dbl_table()[v];
+        for (uint32_t i = 0; i < n; ++i) d[size_t(i) * chans] = dv;
+    }
+    void literal(uint32_t y, uint32_t x, int ch, const uint8_t *p, uint32_t n) {
+        double *d = at(y, x, ch);
+        if (d) expand_u8(p, d, n, chans);
+    }
+    void rows_done(uint32_t y_end, int) { fill_to(y_end); }
+};
+
+/* Fixed-footprint colour histogram for detect_background.  Packed 24-bit
+ * keys and their counts share one open-addressed slot array (linear
+ * probing), sized for at most max_unique colours at load <= 1/2, so it
+ * never rehashes and a lookup touches one or two cache lines. */
+class ColorCounter {
+public:
+    explicit ColorCounter(size_t max_unique) : size_(0), limit_(max_unique), shift_(32 - 4) {
+        size_t cap = 16;
+        while (cap < 2 * max_unique) { cap <<= 1; --shift_; }
+        slots_.assign(cap, Slot{EMPTY, 0});
+        mask_ = cap - 1;
+    }
+
+    /* Count slot for key, inserted at zero if new; NULL once limit colours
+     * are already held. */
+    uint32_t *slot(uint32_t key) {
+        size_t i = size_t((key * 0x9E3779B1u) >> shift_);
+        for (;;) {
+            Slot &s = slots_[i];
+            if (s.key == key) return &s.count;
+            if (s.key == EMPTY) {
+                if (size_ >= limit_) return NULL;
+                ++size_;
+                s.key = key;
+                return &s.count;
+            }
+            i = (i + 1) & mask_;
         }
     }
 
-    out->width = w;
-    out->height = h;
-    out->channels = channels;
-    out->alpha_channel = has_alpha ? 1 : 0;
-    out->color_space = ICV_COLOR_SPACE_RGB;
-    out->data = data;
-    out->magic = ICV_IMAGE_MAGIC;
-    return true;
-}
+private:
+    static constexpr uint32_t EMPTY = 0xFFFFFFFFu;  /* never a 24-bit key */
+    struct Slot { uint32_t key; uint32_t count; };
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    size_t size_;
+    size_t limit_;
+    unsigned shift_;
+};
 
 struct BackgroundDecision {
     std::vector<uint8_t> color;
     rle::Encoder::BackgroundMode mode;
 };
 
-BackgroundDecision detect_background(const std::vector<uint8_t> &rgb, size_t w, size_t h) {
-    static constexpr size_t UNIQUE_CAP = 65536;
-    static constexpr double CLEAR_THRESH = 0.50;
-    static constexpr double OVERLAY_THRESH = 0.20;
+/* Share of the pixels one colour needs for BG_CLEAR / BG_OVERLAY, and the
+ * number of distinct colours after which detection gives up. */
+constexpr size_t UNIQUE_CAP = 65536;
+constexpr double CLEAR_THRESH = 0.50;
+constexpr double OVERLAY_THRESH = 0.20;
 
+BackgroundDecision detect_background(const uint8_t *rgb, size_t len, size_t w, size_t h) {
     BackgroundDecision bd;
     bd.mode = rle::Encoder::BG_SAVE_ALL;
 
     uint64_t npix;
     if (!safe_mul_u64(w, h, rle::MAX_PIXELS, npix)) return bd;
-    if (!npix || rgb.size() < npix * 3) return bd;
+    if (!npix || len < npix * 3) return bd;
 
     uint64_t clear_needed   = uint64_t(npix * CLEAR_THRESH);
     uint64_t overlay_needed = uint64_t(npix * OVERLAY_THRESH);
 
-    std::unordered_map<uint32_t, uint64_t> freq;
-    freq.reserve(std::min<uint64_t>(npix, 4096));
+    ColorCounter freq(size_t(std::min<uint64_t>(npix, UNIQUE_CAP)));
 
     uint64_t maxCount = 0;
     uint32_t maxKey = 0;
+    uint32_t prevKey = 0xFFFFFFFFu;
+    uint32_t *count = NULL;
 
     for (uint64_t i = 0; i < npix; ++i) {
         uint32_t key = (uint32_t(rgb[3*i + 0]) << 16) |
                        (uint32_t(rgb[3*i + 1]) << 8)  |
                        uint32_t(rgb[3*i + 2]);
-        auto it = freq.find(key);
-        if (it == freq.end()) {
-            if (freq.size() >= UNIQUE_CAP) return bd;
-            it = freq.emplace(key, 1).first;
-        } else {
-            ++(it->second);
+        /* Runs of one colour are common; reuse the previous slot. */
+        if (key != prevKey) {
+            count = freq.slot(key);
+            if (!count) return bd;
+            prevKey = key;
         }
-        if (it->second > maxCount) {
-            maxCount = it->second;
+        if (++*count > maxCount) {
+            maxCount = *count;
             maxKey = key;
             if (maxCount >= clear_needed) {
                 bd.mode = rle::Encoder::BG_CLEAR;
@@ -259,6 +463,27 @@ void log_rle_error(const char *context, rle::Error e) {
 
 /* -------------------- Public API -------------------- */
 
+void
+rle_quantize_u8(const double *src, uint8_t *dst, size_t n)
+{
+    quantize_u8(src, dst, n);
+}
+
+void
+rle_expand_u8(const uint8_t *src, double *dst, size_t n)
+{
+    expand_u8(src, dst, n, 1);
+}
+
+rle::Encoder::BackgroundMode
+rle_detect_background(const uint8_t *rgb, size_t w, size_t h, uint8_t color[3])
+{
+    BackgroundDecision bd = detect_background(rgb, w * h * 3, w, h);
+    if (bd.mode != rle::Encoder::BG_SAVE_ALL)
+        std::copy(bd.color.begin(), bd.color.end(), color);
+    return bd.mode;
+}
+
 int
 rle_write(icv_image_t *bif, FILE *fp)
 {
@@ -296,7 +521,8 @@ rle_write(icv_image_t *bif, FILE *fp)
         }
     }
     
-    BackgroundDecision bgd = detect_background(has_alpha ? rgb_only : data, bif->width, bif->height);
+    const std::vector<uint8_t> &rgb = has_alpha ? rgb_only : data;
+    BackgroundDecision bgd = detect_background(rgb.data(), rgb.size(), bif->width, bif->height);
     std::vector<std::string> comments = build_comments();
 
     rle::Error err;
@@ -324,24 +550,22 @@ rle_read(FILE *fp)
         return NULL;
     }
 
-    std::vector<uint8_t> rgb;
-    uint32_t width = 0, height = 0;
-    bool has_alpha = false;
-    std::vector<std::string> comments;
-    rle::Error err;
-
-    bool ok = rle::read_rgb(fp, rgb, width, height,
-                                    &has_alpha, &comments, err);
+    /* Decode straight into the icv double buffer; no 8-bit image or copy */
+    rle::Header h;
+    IcvSink sink;
+    rle::DecoderResult dr = rle::Decoder::read_sink(fp, h, sink);
 
-    if (!ok || err != rle::Error::OK) {
-        log_rle_error("rle_read", err);
+    if (!dr.ok) {
+        log_rle_error("rle_read", dr.error);
+        if (sink.data) bu_free(sink.data, "rle_icv_data");
         /* Do not fclose(fp); caller owns the FILE* */
         return NULL;
     }
 
-    if (width > rle::MAX_DIM || height > rle::MAX_DIM) {
+    if (h.width() > rle::MAX_DIM || h.height() > rle::MAX_DIM) {
         bu_log("rle_read: dimensions exceed maximum (%u x %u)\n",
                rle::MAX_DIM, rle::MAX_DIM);
+        bu_free(sink.data, "rle_icv_data");
         return NULL;
     }
 
@@ -349,13 +573,12 @@ rle_read(FILE *fp)
     BU_ALLOC(img, struct icv_image);
     ICV_IMAGE_INIT(img);
 
-    if (!u8_interleaved_to_icv(rgb, static_cast<size_t>(width),
-                               static_cast<size_t>(height), has_alpha, img)) {
-        bu_log("rle_read: buffer to icv image conversion failed\n");
-        bu_free(img, "icv_image");
-        return NULL;
-    }
-
+    img->width = h.width();
+    img->height = h.height();
+    img->channels = sink.chans;
+    img->alpha_channel = (sink.chans == 4) ? 1 : 0;
+    img->color_space = ICV_COLOR_SPACE_RGB;
+    img->data = sink.data;
     return img;
 }
 
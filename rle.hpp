@@ -32,19 +32,52 @@
  *   RLE_TIMESTAMP_ENABLED          (default 1)
  *   STRICT_RLE_ENDIAN              (force little-endian only)
  *   RLE_NO_EXCEPTIONS              (return bool instead of throw)
+ *   RLE_NO_MMAP                    (read whole files instead of mmap)
+ *   RLE_NO_THREADS                 (parallel entry points run serially)
+ *   RLE_NO_SIMD                    (scalar scanning and rle.cpp pixel conversion)
  */
 
 #ifndef BRLCAD_RLE_HPP
 #define BRLCAD_RLE_HPP
 
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <vector>
 #include <string>
 #include <cstring>
+#include <cstdlib>
 #include <stdexcept>
 #include <chrono>
 #include <limits>
+#include <functional>
+#include <memory>
+
+#ifndef RLE_NO_THREADS
+  #include <thread>
+  #include <atomic>
+#endif
+
+#if !defined(RLE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || \
+                               (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+  #define RLE_HAVE_SSE2 1
+  #include <emmintrin.h>
+  #if defined(__AVX2__)
+    #define RLE_HAVE_AVX2 1
+    #include <immintrin.h>
+  #endif
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+  #endif
+#endif
+
+#if !defined(RLE_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+  #define RLE_HAVE_MMAP 1
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
 
 typedef enum {
     ICV_COLOR_SPACE_RGB,
@@ -137,6 +170,7 @@ enum class Error {
     OPCODE_UNKNOWN,
     TRUNCATED_OPCODE,
     OP_COUNT_EXCEEDED,
+    OUTPUT_OVERFLOW,
     INTERNAL_ERROR
 };
 
@@ -158,6 +192,7 @@ inline const char* error_string(Error e) {
         case Error::OPCODE_UNKNOWN: return "Unknown opcode";
         case Error::TRUNCATED_OPCODE: return "Truncated opcode data";
         case Error::OP_COUNT_EXCEEDED: return "Opcode count per row exceeded";
+        case Error::OUTPUT_OVERFLOW: return "Output buffer too small";
         case Error::INTERNAL_ERROR: return "Internal error";
         default: return "Unknown";
     }
@@ -204,6 +239,477 @@ inline bool discard_bytes(FILE* f, uint64_t n) {
     return true;
 }
 
+/*
+ * Buffered byte source used by the header reader and the decoder.
+ *
+ * FILE* input is pulled in BLOCK-sized chunks with fread() and served from
+ * an internal buffer, so read_u8()/read_u16() are a pointer bump instead of
+ * a locked stdio call per byte.  Memory input is served in place.  Offsets
+ * reported by tell()/accepted by seek() are relative to where the source
+ * started.  On destruction (or release()) a FILE* is repositioned just past
+ * the bytes actually consumed, so callers see the same stream position the
+ * unbuffered fgetc() path left behind.
+ */
+class ByteSource {
+public:
+    static constexpr size_t BLOCK = 64 * 1024;
+
+    explicit ByteSource(FILE* f)
+        : f_(f), base_(f ? std::ftell(f) : -1L) {}
+    ByteSource(const uint8_t* data, size_t len)
+        : win_(data), p_(data), end_(data ? data + len : data) {}
+    ~ByteSource() { release(); }
+
+    ByteSource(const ByteSource&) = delete;
+    ByteSource& operator=(const ByteSource&) = delete;
+
+    /* Memory sources can always seek; FILE sources need a valid ftell(). */
+    bool seekable() const { return !f_ || base_ != -1L; }
+    uint64_t tell() const { return win_off_ + uint64_t(p_ - win_); }
+
+    inline bool get(uint8_t& v) {
+        if (p_ == end_ && !refill()) return false;
+        v = *p_++;
+        return true;
+    }
+    inline bool get_u16(Endian e, uint16_t& v) {
+        uint8_t b0, b1;
+        if (end_ - p_ >= 2) { b0 = p_[0]; b1 = p_[1]; p_ += 2; }
+        else if (!get(b0) || !get(b1)) return false;
+        if (e == Endian::Little) v = uint16_t(b0) | (uint16_t(b1) << 8);
+        else                     v = uint16_t(b1) | (uint16_t(b0) << 8);
+        return true;
+    }
+
+    /* Return up to 'want' contiguous bytes in place and consume them.
+     * Returns 0 only at end of input. */
+    inline size_t next_span(const uint8_t*& ptr, size_t want) {
+        if (p_ == end_ && !refill()) return 0;
+        size_t avail = size_t(end_ - p_);
+        size_t n = (want < avail) ? want : avail;
+        ptr = p_; p_ += n;
+        return n;
+    }
+
+    bool read(uint8_t* dst, size_t n) {
+        while (n > 0) {
+            const uint8_t* p;
+            size_t got = next_span(p, n);
+            if (!got) return false;
+            std::memcpy(dst, p, got);
+            dst += got; n -= got;
+        }
+        return true;
+    }
+
+    bool skip(uint64_t n) {
+        while (n > 0) {
+            if (p_ == end_ && !refill()) return false;
+            uint64_t avail = uint64_t(end_ - p_);
+            uint64_t step = (n < avail) ? n : avail;
+            p_ += step; n -= step;
+        }
+        return true;
+    }
+
+    bool seek(uint64_t off) {
+        uint64_t win_len = uint64_t(end_ - win_);
+        if (off >= win_off_ && off - win_off_ <= win_len) {
+            p_ = win_ + (off - win_off_);
+            return true;
+        }
+        if (!f_ || base_ == -1L) return false;
+        if (off > uint64_t(std::numeric_limits<long>::max() - base_)) return false;
+        if (std::fseek(f_, base_ + long(off), SEEK_SET) != 0) return false;
+        win_off_ = off;
+        win_ = p_ = end_ = buf_.data();
+        return true;
+    }
+
+    /* Hand unconsumed read-ahead back to the FILE*. */
+    void release() {
+        if (!f_ || base_ == -1L || !buffered_) return;
+        std::fseek(f_, base_ + long(tell()), SEEK_SET);
+        buffered_ = false;
+    }
+
+private:
+    bool refill() {
+        if (!f_) return false;
+        if (buf_.empty()) buf_.resize(size_t(BLOCK));
+        win_off_ += uint64_t(end_ - win_);
+        size_t got = std::fread(buf_.data(), 1, BLOCK, f_);
+        win_ = p_ = buf_.data();
+        end_ = win_ + got;
+        if (got) buffered_ = true;
+        return got != 0;
+    }
+
+    FILE* f_ = nullptr;
+    long base_ = -1L;
+    bool buffered_ = false;
+    std::vector<uint8_t> buf_;
+    const uint8_t* win_ = nullptr;
+    const uint8_t* p_ = nullptr;
+    const uint8_t* end_ = nullptr;
+    uint64_t win_off_ = 0;
+};
+
+inline bool read_u16(ByteSource& s, Endian e, uint16_t& v) { return s.get_u16(e, v); }
+inline bool read_u8(ByteSource& s, uint8_t& v) { return s.get(v); }
+
+/*
+ * Buffered byte sink used by the header writer and the encoder.
+ *
+ * Three targets share one put() path:
+ *   - FILE*: bytes are collected in a reusable BLOCK-sized buffer and handed
+ *     to fwrite() in one call whenever it fills.
+ *   - std::vector: bytes are appended in place; the vector grows
+ *     geometrically and is trimmed to the written length on flush().
+ *   - fixed caller buffer: bytes are written in place; running out of room
+ *     latches overflowed().
+ * put()/write() never report errors themselves; a failure latches and is
+ * observed through ok()/failure() or the result of flush().
+ */
+class ByteSink {
+public:
+    static constexpr size_t BLOCK = 64 * 1024;
+
+    explicit ByteSink(FILE* f) : f_(f), own_(size_t(BLOCK)) {
+        buf_ = own_.data(); cap_ = own_.size();
+        if (!f_) failed_ = true;
+    }
+    explicit ByteSink(std::vector<uint8_t>& v) : vec_(&v), base_(v.size()) {}
+    ByteSink(uint8_t* buf, size_t cap) : buf_(buf), cap_(buf ? cap : 0) {}
+    ~ByteSink() { flush(); }
+
+    ByteSink(const ByteSink&) = delete;
+    ByteSink& operator=(const ByteSink&) = delete;
+
+    inline void put(uint8_t v) {
+        if (len_ == cap_ && !drain()) return;
+        buf_[len_++] = v;
+    }
+    inline void put_u16_le(uint16_t v) {
+        put(uint8_t(v & 0xFF));
+        put(uint8_t((v >> 8) & 0xFF));
+    }
+    void write(const uint8_t* p, size_t n) {
+        while (n > 0) {
+            if (len_ == cap_ && !drain()) return;
+            size_t room = cap_ - len_;
+            size_t step = (n < room) ? n : room;
+            std::memcpy(buf_ + len_, p, step);
+            len_ += step; p += step; n -= step;
+        }
+    }
+
+    bool flush() {
+        if (vec_) {
+            vec_->resize(base_ + len_);
+            buf_ = vec_->data() + base_; cap_ = len_;
+            return !failed_;
+        }
+        if (f_) return drain();
+        return !failed_;
+    }
+
+    /* Bytes emitted so far, including any already flushed. */
+    uint64_t tell() const { return flushed_ + len_; }
+
+    bool ok() const { return !failed_; }
+    bool overflowed() const { return overflow_; }
+    Error failure() const { return overflow_ ? Error::OUTPUT_OVERFLOW : Error::INTERNAL_ERROR; }
+
+private:
+    bool drain() {
+        if (failed_) return false;
+        if (vec_) {
+            size_t want = vec_->size() * 2;
+            if (want < base_ + len_ + BLOCK) want = base_ + len_ + BLOCK;
+            try { vec_->resize(want); }
+            catch (...) { failed_ = true; return false; }
+            buf_ = vec_->data() + base_; cap_ = vec_->size() - base_;
+            return true;
+        }
+        if (!f_) { overflow_ = failed_ = true; return false; }
+        if (len_ && std::fwrite(buf_, 1, len_, f_) != len_) failed_ = true;
+        flushed_ += len_; len_ = 0;
+        return !failed_;
+    }
+
+    FILE* f_ = nullptr;
+    std::vector<uint8_t> own_;
+    std::vector<uint8_t>* vec_ = nullptr;
+    size_t base_ = 0;
+    uint8_t* buf_ = nullptr;
+    size_t cap_ = 0;
+    size_t len_ = 0;
+    uint64_t flushed_ = 0;
+    bool failed_ = false;
+    bool overflow_ = false;
+};
+
+/* ----- Scanning kernels over one contiguous channel of a scanline -----
+ * The SSE2/AVX2 paths compare 16/32 bytes per step and locate the first
+ * hit from the movemask; the scalar tails (and RLE_NO_SIMD builds) give
+ * the same answers one byte at a time. */
+#ifdef RLE_HAVE_SSE2
+inline uint32_t first_set_bit(uint32_t m) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return uint32_t(i);
+#else
+    return uint32_t(__builtin_ctz(m));
+#endif
+}
+#endif
+
+/* Length of the run of p[0] at the start of p[0, n); n >= 1. */
+inline uint32_t scan_run(const uint8_t* p, uint32_t n) {
+    const uint8_t v = p[0];
+    uint32_t i = 1;
+#ifdef RLE_HAVE_AVX2
+    const __m256i v32 = _mm256_set1_epi8(char(v));
+    for (; i + 32 <= n; i += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), v32);
+        uint32_t miss = ~uint32_t(_mm256_movemask_epi8(eq));
+        if (miss) return i + first_set_bit(miss);
+    }
+#endif
+#ifdef RLE_HAVE_SSE2
+    const __m128i v16 = _mm_set1_epi8(char(v));
+    for (; i + 16 <= n; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), v16);
+        uint32_t miss = ~uint32_t(_mm_movemask_epi8(eq)) & 0xFFFFu;
+        if (miss) return i + first_set_bit(miss);
+    }
+#endif
+    while (i < n && p[i] == v) ++i;
+    return i;
+}
+
+/* First i with p[i] == p[i+1] == p[i+2] and i + 2 < n, i.e. where a
+ * literal span must stop for a run; n if there is none. */
+inline uint32_t scan_triple(const uint8_t* p, uint32_t n) {
+    uint32_t i = 0;
+#ifdef RLE_HAVE_AVX2
+    for (; i + 34 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 1));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 2));
+        uint32_t hit = uint32_t(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, b), _mm256_cmpeq_epi8(b, c))));
+        if (hit) return i + first_set_bit(hit);
+    }
+#endif
+#ifdef RLE_HAVE_SSE2
+    for (; i + 18 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 1));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 2));
+        uint32_t hit = uint32_t(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, b), _mm_cmpeq_epi8(b, c))));
+        if (hit) return i + first_set_bit(hit);
+    }
+#endif
+    for (; i + 2 < n; ++i)
+        if (p[i] == p[i + 1] && p[i + 1] == p[i + 2]) return i;
+    return n;
+}
+
+/* Split an interleaved scanline of W pixels into 'chans' contiguous planes
+ * (plane c at planes + c * W).  Pixels start every 'stride' bytes (0 means
+ * 'chans'; more skips padding such as the X of RGBX).  4-byte pixels and
+ * packed 3-channel rows are transposed 16 pixels at a time with SSE2; other
+ * layouts and the tail go bytewise. */
+inline void deinterleave_row(const uint8_t* row, uint32_t W, uint8_t chans, uint8_t* planes,
+                             size_t stride = 0) {
+    if (stride == 0) stride = chans;
+    uint32_t x = 0;
+#ifdef RLE_HAVE_SSE2
+    if (stride == 4 && chans <= 4) {
+        /* Each pixel is one 32-bit lane: shift the channel down, mask, and
+         * narrow 4 x 4 lanes to 16 bytes */
+        const __m128i lo = _mm_set1_epi32(0xFF);
+        for (; x + 16 <= W; x += 16) {
+            const __m128i* s = reinterpret_cast<const __m128i*>(row + size_t(x) * 4);
+            __m128i a = _mm_loadu_si128(s), b = _mm_loadu_si128(s + 1);
+            __m128i c = _mm_loadu_si128(s + 2), d = _mm_loadu_si128(s + 3);
+            for (int ch = 0; ch < chans; ++ch) {
+                __m128i ab = _mm_packs_epi32(_mm_and_si128(a, lo), _mm_and_si128(b, lo));
+                __m128i cd = _mm_packs_epi32(_mm_and_si128(c, lo), _mm_and_si128(d, lo));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(planes + size_t(ch) * W + x),
+                                 _mm_packus_epi16(ab, cd));
+                a = _mm_srli_epi32(a, 8); b = _mm_srli_epi32(b, 8);
+                c = _mm_srli_epi32(c, 8); d = _mm_srli_epi32(d, 8);
+            }
+        }
+    } else if (stride == 3 && chans == 3) {
+        /* The byte shuffle below has period 4 on a 3-way interleave, so four
+         * rounds of it leave R, G and B each in one register */
+        for (; x + 16 <= W; x += 16) {
+            const __m128i* s = reinterpret_cast<const __m128i*>(row + size_t(x) * 3);
+            __m128i t0 = _mm_loadu_si128(s), t1 = _mm_loadu_si128(s + 1), t2 = _mm_loadu_si128(s + 2);
+            for (int round = 0; round < 4; ++round) {
+                __m128i u0 = _mm_unpacklo_epi8(t0, _mm_unpackhi_epi64(t1, t1));
+                __m128i u1 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t0, t0), t2);
+                __m128i u2 = _mm_unpacklo_epi8(t1, _mm_unpackhi_epi64(t2, t2));
+                t0 = u0; t1 = u1; t2 = u2;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes + x), t0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes + W + x), t1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes + 2 * size_t(W) + x), t2);
+        }
+    }
+#endif
+    for (uint8_t c = 0; c < chans; ++c) {
+        const uint8_t* s = row + c;
+        uint8_t* d = planes + size_t(c) * W;
+        for (uint32_t i = x; i < W; ++i) d[i] = s[size_t(i) * stride];
+    }
+}
+
+/* mask[x] = 0xFF where plane c matches bg[c] for every c < ncolors, else
+ * 0.  Returns true if every pixel matches. */
+inline bool match_background(const uint8_t* planes, uint32_t W, uint8_t ncolors,
+                             const uint8_t* bg, uint8_t* mask) {
+    uint32_t x = 0;
+    bool all = true;
+#ifdef RLE_HAVE_AVX2
+    for (; x + 32 <= W; x += 32) {
+        __m256i m = _mm256_set1_epi8(char(0xFF));
+        for (uint8_t c = 0; c < ncolors; ++c)
+            m = _mm256_and_si256(m, _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes + size_t(c) * W + x)),
+                _mm256_set1_epi8(char(bg[c]))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(mask + x), m);
+        all = all && _mm256_movemask_epi8(m) == -1;
+    }
+#endif
+#ifdef RLE_HAVE_SSE2
+    for (; x + 16 <= W; x += 16) {
+        __m128i m = _mm_set1_epi8(char(0xFF));
+        for (uint8_t c = 0; c < ncolors; ++c)
+            m = _mm_and_si128(m, _mm_cmpeq_epi8(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes + size_t(c) * W + x)),
+                _mm_set1_epi8(char(bg[c]))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mask + x), m);
+        all = all && _mm_movemask_epi8(m) == 0xFFFF;
+    }
+#endif
+    for (; x < W; ++x) {
+        uint8_t m = 0xFF;
+        for (uint8_t c = 0; c < ncolors; ++c)
+            if (planes[size_t(c) * W + x] != bg[c]) { m = 0; break; }
+        mask[x] = m;
+        all = all && m;
+    }
+    return all;
+}
+
+/* Emit an opcode with its short (8-bit) or long (16-bit) operand form. */
+inline void put_opcode(ByteSink& out, uint8_t op, uint32_t operand) {
+    if (operand <= 255) {
+        out.put(op);
+        out.put(uint8_t(operand));
+    } else {
+        out.put(uint8_t(op | OPC_LONG_FLAG));
+        out.put(0);
+        out.put_u16_le(uint16_t(operand));
+    }
+}
+
+/*
+ * Read-only view of an entire file for the memory decoder.
+ *
+ * Where mmap() is available the file is mapped privately and advised for
+ * sequential access, so decoding walks the page cache directly with no
+ * stdio buffer in between.  Elsewhere (or with RLE_NO_MMAP) the file is
+ * read into an owned buffer once.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path) {
+        close();
+        if (!path) return false;
+#ifdef RLE_HAVE_MMAP
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        bool ok = map_fd(fd);
+        ::close(fd);
+        return ok;
+#else
+        FILE* f = std::fopen(path, "rb");
+        if (!f) return false;
+        bool ok = true;
+        uint8_t chunk[4096];
+        size_t got;
+        try {
+            while ((got = std::fread(chunk, 1, sizeof(chunk), f)) > 0)
+                own_.insert(own_.end(), chunk, chunk + got);
+        } catch (...) { ok = false; }
+        if (std::ferror(f)) ok = false;
+        std::fclose(f);
+        if (!ok) { own_.clear(); return false; }
+        data_ = own_.data(); size_ = own_.size();
+        return true;
+#endif
+    }
+
+#ifdef RLE_HAVE_MMAP
+    /* Map the whole file behind 'fd' (from offset 0).  The descriptor is
+     * not closed and its offset is not moved. */
+    bool open_fd(int fd) {
+        close();
+        return fd >= 0 && map_fd(fd);
+    }
+#endif
+
+    void close() {
+#ifdef RLE_HAVE_MMAP
+        if (map_) ::munmap(map_, size_);
+        map_ = nullptr;
+#endif
+        own_.clear();
+        data_ = nullptr; size_ = 0;
+    }
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+#ifdef RLE_HAVE_MMAP
+    bool map_fd(int fd) {
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 0) return false;
+        if (uint64_t(st.st_size) > uint64_t(std::numeric_limits<size_t>::max())) return false;
+        size_ = size_t(st.st_size);
+        if (size_ == 0) return true;   /* empty file: decoder reports truncation */
+        void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) { size_ = 0; return false; }
+#ifdef MADV_SEQUENTIAL
+        ::madvise(p, size_, MADV_SEQUENTIAL);
+#endif
+        map_ = p;
+        data_ = static_cast<const uint8_t*>(p);
+        return true;
+    }
+
+    void* map_ = nullptr;
+#endif
+    std::vector<uint8_t> own_;
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
 struct Header {
     uint16_t xpos     = 0;
     uint16_t ypos     = 0;
@@ -264,17 +770,219 @@ inline void unpack_comments(const std::vector<uint8_t>& block, std::vector<std::
     }
 }
 
-inline bool write_header(FILE* f, const Header& h) {
+/*
+ * Scanline seek table carried in an optional "RLE_ROW_INDEX=" comment.
+ *
+ * Entry k lets a reader start decoding at band k * step without parsing
+ * earlier opcodes: seek to 'offset[k]' bytes past the end of the header
+ * and decode from scanline 'row[k]' (<= k * step; earlier when the band
+ * starts inside a SKIP_LINES run) with no channel selected.  Offsets are
+ * relative to the first opcode, so the table does not depend on its own
+ * size.  Text form, compact enough for the comment budget:
+ *
+ *   RLE_ROW_INDEX=<step>/<length>:<e0>,<e1>,...
+ *
+ * where <length> is the hex size of the opcode body (through EOF) the
+ * table was written for, and each entry is the hex offset delta from the
+ * previous entry, optionally followed by "-<hex>" giving k * step - row,
+ * then ".<hex>", a hash of the body from the first opcode to the end of
+ * band k (the next entry's offset, or the body length for the last).
+ * Legacy readers see an ordinary comment.
+ *
+ * Writers that keep comments carry the table into files whose opcodes it
+ * does not describe, and files may be edited in place after indexing, so
+ * a reader checks the table with matches() before seeking and decodes
+ * from the top when it fails.  Any change to the opcodes up to the end of
+ * the band, including one that alters how many scanlines precede it,
+ * fails the hash.
+ */
+struct RowIndex {
+    static constexpr uint32_t DEFAULT_STEP = 64;
+
+    uint32_t step = 0;
+    uint64_t length = 0;              /* body bytes, EOF opcode included */
+    std::vector<uint64_t> offset;
+    std::vector<uint32_t> row;
+    std::vector<uint32_t> check;      /* prefix hashes, filled by seal() */
+
+    static const char* key() { return "RLE_ROW_INDEX="; }
+
+    /* Streaming hash of the opcode body, eight little-endian bytes per
+     * step; value() does not depend on how the bytes were split between
+     * update() calls. */
+    class Hasher {
+    public:
+        void update(const uint8_t* p, size_t n) {
+            total_ += n;
+            for (; ntail_ && n; --n) add_tail(*p++);
+            for (; n >= 8; p += 8, n -= 8)
+                mix(uint64_t(p[0]) | uint64_t(p[1]) << 8 | uint64_t(p[2]) << 16 | uint64_t(p[3]) << 24 |
+                    uint64_t(p[4]) << 32 | uint64_t(p[5]) << 40 | uint64_t(p[6]) << 48 | uint64_t(p[7]) << 56);
+            for (; n; --n) add_tail(*p++);
+        }
+        uint32_t value() const {
+            uint64_t x = (h_ ^ total_ ^ tail_) * 0x9FB21C651E98DF25ULL;
+            x ^= x >> 29;
+            x *= 0xBF58476D1CE4E5B9ULL;
+            return uint32_t(x ^ (x >> 32));
+        }
+
+    private:
+        void mix(uint64_t w) {
+            h_ = (h_ ^ w) * 0x9FB21C651E98DF25ULL;
+            h_ ^= h_ >> 29;
+        }
+        void add_tail(uint8_t b) {
+            tail_ |= uint64_t(b) << (8 * ntail_);
+            if (++ntail_ == 8) { mix(tail_); tail_ = 0; ntail_ = 0; }
+        }
+
+        uint64_t h_ = 0x9E3779B97F4A7C15ULL;
+        uint64_t tail_ = 0;
+        uint64_t total_ = 0;
+        unsigned ntail_ = 0;
+    };
+
+    /* End of band k in the body. */
+    uint64_t band_end(size_t k) const { return k + 1 < offset.size() ? offset[k + 1] : length; }
+
+    /* Hash 'body' (the 'length' opcode bytes the table describes) up to the
+     * end of every band; needed before to_comment(). */
+    void seal(const uint8_t* body) {
+        check.resize(offset.size());
+        Hasher hs;
+        for (size_t k = 0; k < offset.size(); ++k) {
+            hs.update(body + offset[k], size_t(band_end(k) - offset[k]));
+            check[k] = hs.value();
+        }
+    }
+
+    std::string to_comment() const {
+        std::string s(key());
+        char buf[40];
+        std::snprintf(buf, sizeof(buf), "%u/%llx:", unsigned(step), (unsigned long long)length);
+        s += buf;
+        uint64_t prev = 0;
+        for (size_t k = 0; k < offset.size(); ++k) {
+            if (k) s += ',';
+            std::snprintf(buf, sizeof(buf), "%llx", (unsigned long long)(offset[k] - prev));
+            s += buf;
+            uint32_t back = uint32_t(k) * step - row[k];
+            if (back) {
+                std::snprintf(buf, sizeof(buf), "-%x", unsigned(back));
+                s += buf;
+            }
+            std::snprintf(buf, sizeof(buf), ".%x", unsigned(k < check.size() ? check[k] : 0));
+            s += buf;
+            prev = offset[k];
+        }
+        return s;
+    }
+
+    /* Parse and sanity check the index for 'h'; false if absent or bogus. */
+    bool parse(const Header& h) {
+        const std::string k(key());
+        for (const std::string& c : h.comments) {
+            if (c.compare(0, k.size(), k) != 0) continue;
+            step = 0; length = 0; offset.clear(); row.clear(); check.clear();
+            const char* p = c.c_str() + k.size();
+            char* end;
+            unsigned long st = std::strtoul(p, &end, 10);
+            if (end == p || *end != '/' || st == 0 || st > h.height()) return false;
+            step = uint32_t(st);
+            p = end + 1;
+            unsigned long long len = std::strtoull(p, &end, 16);
+            if (end == p || *end != ':') return false;
+            length = len;
+            p = end + 1;
+            uint64_t off = 0;
+            const size_t want = (h.height() + step - 1) / step;
+            while (*p && offset.size() < want) {
+                unsigned long long d = std::strtoull(p, &end, 16);
+                if (end == p) return false;
+                off += d;
+                unsigned long back = 0;
+                p = end;
+                if (*p == '-') {
+                    back = std::strtoul(p + 1, &end, 16);
+                    if (end == p + 1) return false;
+                    p = end;
+                }
+                if (*p != '.') return false;
+                unsigned long hv = std::strtoul(p + 1, &end, 16);
+                if (end == p + 1 || hv > 0xFFFFFFFFul) return false;
+                p = end;
+                uint64_t band = uint64_t(offset.size()) * step;
+                if (back > band) return false;
+                uint32_t r = uint32_t(band - back);
+                if (!row.empty() && (r < row.back() || off < offset.back())) return false;
+                offset.push_back(off);
+                row.push_back(r);
+                check.push_back(uint32_t(hv));
+                if (*p == ',') ++p;
+                else if (*p) return false;
+            }
+            return offset.size() == want && offset[0] == 0 && row[0] == 0 &&
+                   length >= offset.back() + 2;
+        }
+        return false;
+    }
+
+    /*
+     * Check the table against the opcodes in 'src', which start at 'body',
+     * before seeking to entry k: the EOF opcode must sit at the recorded
+     * body length, entry k must land on a row start (SKIP_LINES or, when
+     * the band begins on its own scanline, SET_COLOR 0), and the body up to
+     * the end of band k must hash to check[k].  Hashing reads those bytes
+     * but is far cheaper than decoding them.  Moves the read position.
+     */
+    bool matches(ByteSource& src, uint64_t body, size_t k) const {
+        uint8_t buf[4096];
+        if (!src.seek(body + length - 2) || !src.read(buf, 2) || buf[0] != OPC_EOF || buf[1] != 0)
+            return false;
+        if (!src.seek(body + offset[k]) || !src.read(buf, 2)) return false;
+        if ((buf[0] & ~OPC_LONG_FLAG) != OPC_SKIP_LINES &&
+            (row[k] != uint64_t(k) * step || buf[0] != OPC_SET_COLOR || buf[1] != 0))
+            return false;
+        if (!src.seek(body)) return false;
+        Hasher hs;
+        for (uint64_t left = band_end(k); left; ) {
+            const size_t n = left < sizeof(buf) ? size_t(left) : sizeof(buf);
+            if (!src.read(buf, n)) return false;
+            hs.update(buf, n);
+            left -= n;
+        }
+        return hs.value() == check[k];
+    }
+
+    /* Halve the resolution (dropping any hashes; seal() again), keeping
+     * the step within 'height' so the table still parses; false once a
+     * single entry remains or the step already covers every row. */
+    bool coarsen(uint32_t height) {
+        if (offset.size() <= 1 || step >= height) return false;
+        size_t n = 0;
+        for (size_t k = 0; k < offset.size(); k += 2, ++n) {
+            offset[n] = offset[k];
+            row[n] = row[k];
+        }
+        offset.resize(n); row.resize(n);
+        check.clear();
+        step = step < height / 2 ? step * 2 : height;
+        return true;
+    }
+};
+
+inline bool write_header(ByteSink& out, const Header& h) {
     Error e;
     if (!h.validate(e)) RLE_THROW(error_string(e));
-    if (!write_u16_le(f, RLE_MAGIC)) return false;
-    if (!write_u16_le(f, h.xpos) || !write_u16_le(f, h.ypos) ||
-        !write_u16_le(f, h.xlen) || !write_u16_le(f, h.ylen)) return false;
-    if (!write_u8(f, h.flags) || !write_u8(f, h.ncolors) || !write_u8(f, h.pixelbits) ||
-        !write_u8(f, h.ncmap) || !write_u8(f, h.cmaplen)) return false;
+    out.put_u16_le(RLE_MAGIC);
+    out.put_u16_le(h.xpos); out.put_u16_le(h.ypos);
+    out.put_u16_le(h.xlen); out.put_u16_le(h.ylen);
+    out.put(h.flags); out.put(h.ncolors); out.put(h.pixelbits);
+    out.put(h.ncmap); out.put(h.cmaplen);
 
     if (!h.no_background()) {
-        for (uint8_t v : h.background) if (!write_u8(f, v)) return false;
+        out.write(h.background.data(), h.background.size());
         /* COMPATIBILITY: Utah RLE reference implementation does NOT write padding
          * after the background block, even when ncolors is odd. The RLE spec
          * describes padding for comments and pixel data, but not for background. */
@@ -284,40 +992,44 @@ inline bool write_header(FILE* f, const Header& h) {
          * format specification suggests no background data should be present.
          * This behavior is found in utahrle/Runput.c line ~220.
          * We replicate this for compatibility. */
-        if (!write_u8(f, 0)) return false;
+        out.put(0);
     }
     if (h.ncmap > 0) {
-        for (uint16_t cv : h.colormap)
-            if (!write_u16_le(f, cv)) return false;
+        for (uint16_t cv : h.colormap) out.put_u16_le(cv);
     }
     if (h.has_comments()) {
         auto packed = pack_comments(h.comments);
         if (packed.size() > MAX_COMMENT_LEN) RLE_THROW("Comment block too large");
         uint16_t clen = uint16_t(packed.size());
-        if (!write_u16_le(f, clen)) return false;
-        for (uint8_t b : packed) if (!write_u8(f, b)) return false;
-        if (clen & 0x01) if (!write_u8(f, 0)) return false;
+        out.put_u16_le(clen);
+        out.write(packed.data(), packed.size());
+        if (clen & 0x01) out.put(0);
     }
-    return true;
+    return out.ok();
 }
 
-inline bool read_header_single(FILE* f, Header& h, Endian e, Error& err) {
-    long start = std::ftell(f);
-    if (start == -1L) { err = Error::INTERNAL_ERROR; return false; }
+inline bool write_header(FILE* f, const Header& h) {
+    ByteSink out(f);
+    if (!write_header(out, h)) return false;
+    return out.flush();
+}
+
+inline bool read_header_single(ByteSource& s, Header& h, Endian e, Error& err) {
+    if (!s.seekable()) { err = Error::INTERNAL_ERROR; return false; }
+    const uint64_t start = s.tell();
+    auto fail = [&](Error why)->bool { err = why; s.seek(start); return false; };
     uint16_t magic;
-    if (!read_u16(f, e, magic)) { err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false; }
-    if (magic != RLE_MAGIC) { err = Error::BAD_MAGIC; std::fseek(f, start, SEEK_SET); return false; }
-    auto rd8 = [&](uint8_t& v)->bool { int c = std::fgetc(f); if (c == EOF) return false; v = uint8_t(c); return true; };
-    if (!read_u16(f, e, h.xpos) || !read_u16(f, e, h.ypos) ||
-        !read_u16(f, e, h.xlen) || !read_u16(f, e, h.ylen) ||
-        !rd8(h.flags) || !rd8(h.ncolors) || !rd8(h.pixelbits) ||
-        !rd8(h.ncmap) || !rd8(h.cmaplen)) {
-        err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false;
+    if (!read_u16(s, e, magic)) return fail(Error::HEADER_TRUNCATED);
+    if (magic != RLE_MAGIC) return fail(Error::BAD_MAGIC);
+    if (!read_u16(s, e, h.xpos) || !read_u16(s, e, h.ypos) ||
+        !read_u16(s, e, h.xlen) || !read_u16(s, e, h.ylen) ||
+        !read_u8(s, h.flags) || !read_u8(s, h.ncolors) || !read_u8(s, h.pixelbits) ||
+        !read_u8(s, h.ncmap) || !read_u8(s, h.cmaplen)) {
+        return fail(Error::HEADER_TRUNCATED);
     }
     if (!(h.flags & FLAG_NO_BACKGROUND)) {
         h.background.resize(h.ncolors);
-        for (uint8_t &v : h.background)
-            if (!rd8(v)) { err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false; }
+        if (!s.read(h.background.data(), h.background.size())) return fail(Error::HEADER_TRUNCATED);
         /* COMPATIBILITY: Utah RLE reference implementation does NOT write padding
          * after the background block, even when ncolors is odd. The RLE spec
          * describes padding for comments and pixel data, but not for background. */
@@ -328,16 +1040,16 @@ inline bool read_header_single(FILE* f, Header& h, Endian e, Error& err) {
          * This behavior is found in utahrle/Runput.c line ~220.
          * We must read this byte for compatibility. */
         uint8_t null_byte;
-        if (!rd8(null_byte)) { err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false; }
+        if (!read_u8(s, null_byte)) return fail(Error::HEADER_TRUNCATED);
     }
     if (h.ncmap > 0) {
-        if (h.ncmap > 3 || h.cmaplen > 8) { err = Error::COLORMAP_TOO_LARGE; std::fseek(f, start, SEEK_SET); return false; }
+        if (h.ncmap > 3 || h.cmaplen > 8) return fail(Error::COLORMAP_TOO_LARGE);
         uint64_t entries = uint64_t(h.ncmap) * (uint64_t(1) << h.cmaplen);
-        if (entries > MAX_COLORMAP_ENTRIES) { err = Error::COLORMAP_TOO_LARGE; std::fseek(f, start, SEEK_SET); return false; }
+        if (entries > MAX_COLORMAP_ENTRIES) return fail(Error::COLORMAP_TOO_LARGE);
         h.colormap.resize(entries);
         for (uint64_t i = 0; i < entries; ++i) {
             uint16_t cv;
-            if (!read_u16(f, e, cv)) { err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false; }
+            if (!read_u16(s, e, cv)) return fail(Error::HEADER_TRUNCATED);
             h.colormap[i] = cv;
         }
         uint16_t all = 0;
@@ -347,43 +1059,48 @@ inline bool read_header_single(FILE* f, Header& h, Endian e, Error& err) {
     }
     if (h.flags & FLAG_COMMENT) {
         uint16_t clen;
-        if (!read_u16(f, e, clen)) { err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false; }
+        if (!read_u16(s, e, clen)) return fail(Error::HEADER_TRUNCATED);
         /* Hardened: if comments too large, read-and-discard instead of failing */
         if (clen > MAX_COMMENT_LEN) {
-            if (!discard_bytes(f, clen)) { err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false; }
-            if (clen & 0x01) { uint8_t pad; if (!read_u8(f, pad)) { err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false; } }
+            if (!s.skip(uint64_t(clen) + (clen & 0x01))) return fail(Error::HEADER_TRUNCATED);
             /* Do not populate h.comments; proceed */
         } else if (clen > 0) {
             std::vector<uint8_t> block(clen);
-            for (uint16_t i = 0; i < clen; ++i)
-                if (!rd8(block[i])) { err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false; }
-            if (clen & 0x01) { uint8_t pad; if (!rd8(pad)) { err = Error::HEADER_TRUNCATED; std::fseek(f, start, SEEK_SET); return false; } }
+            if (!s.read(block.data(), clen)) return fail(Error::HEADER_TRUNCATED);
+            if (clen & 0x01) { uint8_t pad; if (!read_u8(s, pad)) return fail(Error::HEADER_TRUNCATED); }
             unpack_comments(block, h.comments);
         } else {
             /* zero-length comments: still may have even padding (clen==0 => no pad) */
         }
     }
-    if (!h.validate(err)) { std::fseek(f, start, SEEK_SET); return false; }
+    if (!h.validate(err)) { s.seek(start); return false; }
     err = Error::OK;
     return true;
 }
 
-inline bool read_header_auto(FILE* f, Header& h, Endian& chosen, Error& err) {
+inline bool read_header_single(FILE* f, Header& h, Endian e, Error& err) {
+    ByteSource s(f);
+    return read_header_single(s, h, e, err);
+}
+
+inline bool read_header_auto(ByteSource& s, Header& h, Endian& chosen, Error& err) {
 #ifdef STRICT_RLE_ENDIAN
-    if (!read_header_single(f, h, Endian::Little, err)) return false;
+    if (!read_header_single(s, h, Endian::Little, err)) return false;
     chosen = Endian::Little; return true;
 #else
-    long pos = std::ftell(f);
-    if (pos == -1L) { err = Error::INTERNAL_ERROR; return false; }
-    if (read_header_single(f, h, Endian::Little, err)) { chosen = Endian::Little; return true; }
+    if (read_header_single(s, h, Endian::Little, err)) { chosen = Endian::Little; return true; }
     if (err == Error::BAD_MAGIC) {
-        std::fseek(f, pos, SEEK_SET);
-        if (read_header_single(f, h, Endian::Big, err)) { chosen = Endian::Big; return true; }
+        if (read_header_single(s, h, Endian::Big, err)) { chosen = Endian::Big; return true; }
     }
     return false;
 #endif
 }
 
+inline bool read_header_auto(FILE* f, Header& h, Endian& chosen, Error& err) {
+    ByteSource s(f);
+    return read_header_auto(s, h, chosen, err);
+}
+
 struct Image {
     Header header;
     std::vector<uint8_t> pixels;
@@ -427,6 +1144,76 @@ struct Image {
     }
 };
 
+/*
+ * Channel-separated image: plane c holds width * height bytes of channel
+ * c, rows top to bottom, with the alpha plane (if any) last.  Filled by
+ * Decoder::read_planar(); allocate() initialises it like Image::allocate.
+ */
+struct PlanarImage {
+    Header header;
+    std::vector<uint8_t> planes;
+
+    bool allocate(Error& err) {
+        Error hv;
+        if (!header.validate(hv)) { err = hv; return false; }
+        uint64_t total;
+        if (!safe_mul_u64(header.width(), header.height(), MAX_PIXELS, total)) { err = Error::PIXELS_TOO_LARGE; return false; }
+        uint64_t bytes;
+        if (!safe_mul_u64(total, header.channels(), MAX_ALLOC_BYTES, bytes)) { err = Error::ALLOC_TOO_LARGE; return false; }
+        try {
+            planes.assign(size_t(bytes), 0);
+            if (!header.no_background())
+                for (size_t c = 0; c < header.ncolors && c < header.background.size(); ++c)
+                    std::memset(plane(uint8_t(c)), header.background[c], plane_size());
+            if (header.has_alpha()) std::memset(plane(header.ncolors), 255, plane_size());
+        } catch (...) { err = Error::ALLOC_TOO_LARGE; return false; }
+        err = Error::OK; return true;
+    }
+
+    inline size_t plane_size() const { return size_t(header.width()) * header.height(); }
+    inline uint8_t* plane(uint8_t c) { return planes.data() + c * plane_size(); }
+    inline const uint8_t* plane(uint8_t c) const { return planes.data() + c * plane_size(); }
+    inline uint8_t* row(uint8_t c, uint32_t y) { return plane(c) + size_t(y) * header.width(); }
+    inline const uint8_t* row(uint8_t c, uint32_t y) const { return plane(c) + size_t(y) * header.width(); }
+};
+
+/*
+ * Non-owning view of interleaved 8-bit pixels that the encoder reads in
+ * place, such as a renderer's framebuffer.  'header' describes the image as
+ * for Image.  Row y starts at data + y * row_stride, and pixel x of it
+ * x * pixel_stride bytes further on; its first header.channels() bytes are
+ * encoded.  pixel_stride 0 means header.channels() (larger skips padding,
+ * e.g. the X of RGBX) and row_stride 0 means width * pixel_stride.  For a
+ * bottom-up buffer, point data at the row to encode first (the last one in
+ * memory) and give a negative row_stride.  Every pixel must have
+ * pixel_stride readable bytes; the pixels must outlive the encode.
+ */
+struct ImageView {
+    Header header;
+    const uint8_t* data = nullptr;
+    ptrdiff_t row_stride = 0;
+    size_t pixel_stride = 0;
+
+    ImageView() {}
+    ImageView(const Header& h, const uint8_t* pixels, ptrdiff_t row_bytes = 0, size_t pixel_bytes = 0)
+        : header(h), data(pixels), row_stride(row_bytes), pixel_stride(pixel_bytes) {}
+    explicit ImageView(const Image& img) : header(img.header), data(img.pixels.data()) {}
+
+    inline size_t pixel_step() const { return pixel_stride ? pixel_stride : header.channels(); }
+    inline ptrdiff_t row_step() const {
+        return row_stride ? row_stride : ptrdiff_t(size_t(header.width()) * pixel_step());
+    }
+    inline const uint8_t* row(uint32_t y) const { return data + ptrdiff_t(y) * row_step(); }
+    inline const uint8_t* pixel(uint32_t x, uint32_t y) const { return row(y) + size_t(x) * pixel_step(); }
+
+    /* Whether the encoder can read the view: pixels present, each at
+     * least channels() bytes long. */
+    bool usable(Error& err) const {
+        if (!data || pixel_step() < header.channels()) { err = Error::INTERNAL_ERROR; return false; }
+        err = Error::OK; return true;
+    }
+};
+
 inline bool pixel_is_background(const Image& img, uint32_t x, uint32_t y) {
     const uint8_t* p = img.pixel(x, y);
     for (uint8_t c = 0; c < img.header.ncolors; ++c) {
@@ -451,108 +1238,640 @@ class Encoder {
 public:
     enum BackgroundMode { BG_SAVE_ALL = 0, BG_OVERLAY = 1, BG_CLEAR = 2 };
 
+    /* How opcodes are chosen for each channel of a scanline.  GREEDY takes
+     * any run of 3+ and breaks literals at the next one; MAX_COMPRESSION
+     * picks the byte-minimal mix of RUN_DATA, BYTE_DATA and SKIP_PIXELS
+     * (counting operand forms and filler bytes) at a few times the cost. */
+    enum Strategy { GREEDY = 0, MAX_COMPRESSION = 1 };
+
     static bool write(FILE* f, const Image& img, BackgroundMode bg_mode, Error& err) {
         if (!f) { err = Error::INTERNAL_ERROR; return false; }
+        ByteSink out(f);
+        if (!write(out, img, bg_mode, err)) return false;
+        if (!out.flush()) { err = Error::INTERNAL_ERROR; return false; }
+        return true;
+    }
+
+    /* Append the encoded stream to 'out'.  On failure 'out' is restored to
+     * its original length. */
+    static bool write_memory(std::vector<uint8_t>& out, const Image& img, BackgroundMode bg_mode, Error& err) {
+        const size_t base = out.size();
+        bool ok;
+        {
+            ByteSink sink(out);
+            ok = write(sink, img, bg_mode, err) && sink.flush();
+        }
+        if (!ok) out.resize(base);
+        return ok;
+    }
+
+    /* Encode into a fixed caller buffer of 'cap' bytes.  'written' receives
+     * the encoded length; a stream that does not fit fails with
+     * Error::OUTPUT_OVERFLOW. */
+    static bool write_memory(uint8_t* buf, size_t cap, size_t& written,
+                             const Image& img, BackgroundMode bg_mode, Error& err) {
+        ByteSink sink(buf, cap);
+        bool ok = write(sink, img, bg_mode, err);
+        written = size_t(sink.tell());
+        return ok;
+    }
+
+    static bool write(ByteSink& out, const Image& img, BackgroundMode bg_mode, Error& err) {
+        return write(out, img, bg_mode, GREEDY, err);
+    }
+
+    static bool write(FILE* f, const Image& img, BackgroundMode bg_mode, Strategy strategy, Error& err) {
+        if (!f) { err = Error::INTERNAL_ERROR; return false; }
+        ByteSink out(f);
+        if (!write(out, img, bg_mode, strategy, err)) return false;
+        if (!out.flush()) { err = Error::INTERNAL_ERROR; return false; }
+        return true;
+    }
+
+    static bool write(ByteSink& out, const Image& img, BackgroundMode bg_mode, Strategy strategy, Error& err);
 
-        Header h = img.header;
-        if (bg_mode == BG_CLEAR) h.flags |= FLAG_CLEAR_FIRST;
-        if (img.header.has_alpha()) h.flags |= FLAG_ALPHA;
-        if (!img.header.comments.empty()) h.flags |= FLAG_COMMENT;
-        if (h.background.empty()) h.flags |= FLAG_NO_BACKGROUND;
+    /*
+     * Encode straight from a caller-owned pixel buffer (see ImageView) with
+     * no copy; the stream is byte-identical to write() of an Image holding
+     * the same pixels.
+     */
+    static bool write(FILE* f, const ImageView& view, BackgroundMode bg_mode, Error& err) {
+        return write(f, view, bg_mode, GREEDY, err);
+    }
 
-        if (!write_header(f, h)) { err = Error::INTERNAL_ERROR; return false; }
+    static bool write(FILE* f, const ImageView& view, BackgroundMode bg_mode, Strategy strategy, Error& err) {
+        if (!f) { err = Error::INTERNAL_ERROR; return false; }
+        ByteSink out(f);
+        if (!write(out, view, bg_mode, strategy, err)) return false;
+        if (!out.flush()) { err = Error::INTERNAL_ERROR; return false; }
+        return true;
+    }
+
+    static bool write_memory(std::vector<uint8_t>& out, const ImageView& view, BackgroundMode bg_mode, Error& err) {
+        const size_t base = out.size();
+        bool ok;
+        {
+            ByteSink sink(out);
+            ok = write(sink, view, bg_mode, err) && sink.flush();
+        }
+        if (!ok) out.resize(base);
+        return ok;
+    }
+
+    static bool write(ByteSink& out, const ImageView& view, BackgroundMode bg_mode, Error& err) {
+        return write(out, view, bg_mode, GREEDY, err);
+    }
+
+    static bool write(ByteSink& out, const ImageView& view, BackgroundMode bg_mode, Strategy strategy, Error& err);
+
+    /*
+     * Band-parallel encode.  The image is split into horizontal bands that
+     * are encoded into private buffers on up to 'threads' workers (0 picks
+     * std::thread::hardware_concurrency()).  The buffers are then stitched
+     * in row order, re-coalescing background rows into SKIP_LINES across
+     * band boundaries, so the stream is byte-identical to write().
+     * Peak extra memory is the size of the encoded stream.
+     */
+    static bool write_parallel(FILE* f, const Image& img, BackgroundMode bg_mode,
+                               unsigned threads, Error& err) {
+        if (!f) { err = Error::INTERNAL_ERROR; return false; }
+        ByteSink out(f);
+        if (!write_parallel(out, img, bg_mode, threads, err)) return false;
+        if (!out.flush()) { err = Error::INTERNAL_ERROR; return false; }
+        return true;
+    }
+
+    static bool write_parallel(ByteSink& out, const Image& img, BackgroundMode bg_mode,
+                               unsigned threads, Error& err);
+
+    static bool write_parallel(FILE* f, const ImageView& view, BackgroundMode bg_mode,
+                               unsigned threads, Error& err) {
+        if (!f) { err = Error::INTERNAL_ERROR; return false; }
+        ByteSink out(f);
+        if (!write_parallel(out, view, bg_mode, threads, err)) return false;
+        if (!out.flush()) { err = Error::INTERNAL_ERROR; return false; }
+        return true;
+    }
+
+    static bool write_parallel(ByteSink& out, const ImageView& view, BackgroundMode bg_mode,
+                               unsigned threads, Error& err);
+
+    /*
+     * Like write(), but adds a RowIndex comment with an entry every 'step'
+     * rows (0 = RowIndex::DEFAULT_STEP, or less for images under twice
+     * that height; at most the height) so readers can seek to a row band
+     * via Decoder::read_row_range().  The opcode body is staged in memory
+     * first because the header precedes it.  If the table does not fit in
+     * MAX_COMMENT_LEN alongside the other comments it is coarsened, and
+     * dropped only if even one entry will not fit.  Any RLE_ROW_INDEX=
+     * comment already in img.header is replaced.
+     */
+    static bool write_indexed(FILE* f, const Image& img, BackgroundMode bg_mode,
+                              uint32_t step, Error& err) {
+        if (!f) { err = Error::INTERNAL_ERROR; return false; }
+        ByteSink out(f);
+        if (!write_indexed(out, img, bg_mode, step, err)) return false;
+        if (!out.flush()) { err = Error::INTERNAL_ERROR; return false; }
+        return true;
+    }
+
+    static bool write_indexed(ByteSink& out, const Image& img, BackgroundMode bg_mode,
+                              uint32_t step, Error& err);
+
+    /* The header actually written for 'h' under 'bg_mode'. */
+    static Header stream_header(const Header& h, BackgroundMode bg_mode) {
+        Header out = h;
+        if (bg_mode == BG_CLEAR) out.flags |= FLAG_CLEAR_FIRST;
+        if (!h.comments.empty()) out.flags |= FLAG_COMMENT;
+        if (out.background.empty()) out.flags |= FLAG_NO_BACKGROUND;
+        return out;
+    }
 
+    /* True if an interleaved scanline can be replaced by SKIP_LINES: every
+     * pixel matches the background color and any alpha is zero. */
+    static bool row_is_skippable(const Header& h, const uint8_t* row, BackgroundMode bg_mode) {
+        if (bg_mode == BG_SAVE_ALL || h.no_background() || h.background.empty()) return false;
         const uint32_t W = h.width();
-        const uint32_t H = h.height();
         const uint8_t chans = h.channels();
+        for (uint32_t x = 0; x < W; ++x) {
+            const uint8_t* p = row + size_t(x) * chans;
+            for (uint8_t c = 0; c < h.ncolors; ++c)
+                if (p[c] != h.background[c]) return false;
+            if (h.has_alpha() && p[chans - 1] != 0) return false;
+        }
+        return true;
+    }
 
-        uint32_t y = 0;
-        while (y < H) {
-            if (bg_mode != BG_SAVE_ALL && !h.no_background() && row_is_background(img, y)) {
-                uint32_t start = y;
-                while (y < H && row_is_background(img, y) && (y - start) < 65535) ++y;
-                uint32_t skipCount = y - start;
-                if (skipCount <= 255) {
-                    if (!write_u8(f, OPC_SKIP_LINES) || !write_u8(f, uint8_t(skipCount))) { err = Error::INTERNAL_ERROR; return false; }
-                } else {
-                    if (!write_u8(f, OPC_SKIP_LINES | OPC_LONG_FLAG) || !write_u8(f, 0) || !write_u16_le(f, uint16_t(skipCount))) { err = Error::INTERNAL_ERROR; return false; }
-                }
-                continue;
+    /* Per-encoder working memory for encode_row(), sized once by reserve() */
+    struct Scratch {
+        std::vector<uint8_t> planes;        /* row split into channel planes */
+        std::vector<uint8_t> bg;            /* per-pixel background mask */
+        bool has_bg = false;                /* 'bg' is valid for this row */
+        std::vector<uint32_t> cost, next;   /* MAX_COMPRESSION parse tables */
+        std::vector<uint8_t> kind;
+        std::vector<uint32_t> window;
+
+        void reserve(const Header& h, Strategy strategy) {
+            const size_t W = h.width();
+            planes.resize(W * h.channels());
+            bg.resize(W);
+            if (strategy == MAX_COMPRESSION) {
+                cost.resize(W + 1); next.resize(W + 1); kind.resize(W + 1);
+                window.resize(4 * (W + 1));
             }
+        }
+    };
+
+    /*
+     * Split an interleaved scanline (pixels 'pixel_stride' bytes apart, 0
+     * for packed) into scratch.planes and, unless
+     * 'bg_mode' saves everything, build the per-pixel background mask that
+     * all colour channels' SKIP_PIXELS decisions share.  Returns true if
+     * the row can be replaced by SKIP_LINES (row_is_skippable()).
+     */
+    static bool stage_row(const Header& h, const uint8_t* row, BackgroundMode bg_mode,
+                          Strategy strategy, Scratch& scratch, size_t pixel_stride = 0) {
+        const uint32_t W = h.width();
+        const uint8_t chans = h.channels();
+        if (scratch.planes.size() < size_t(W) * chans || scratch.bg.size() < W ||
+            (strategy == MAX_COMPRESSION && scratch.cost.size() <= W))
+            scratch.reserve(h, strategy);
+        deinterleave_row(row, W, chans, scratch.planes.data(), pixel_stride);
+        scratch.has_bg = bg_mode != BG_SAVE_ALL && h.background.size() >= h.ncolors && h.ncolors;
+        if (!scratch.has_bg) return false;
+        const bool all_bg = match_background(scratch.planes.data(), W, h.ncolors,
+                                             h.background.data(), scratch.bg.data());
+        if (!all_bg || h.no_background()) return false;
+        if (!h.has_alpha()) return true;
+        const uint8_t* alpha = scratch.planes.data() + size_t(h.ncolors) * W;
+        return alpha[0] == 0 && scan_run(alpha, W) == W;
+    }
 
-            for (uint8_t c = 0; c < chans; ++c) {
-                uint16_t operand = (c == h.ncolors && h.has_alpha()) ? 255 : c;
-                if (!write_u8(f, OPC_SET_COLOR) || !write_u8(f, uint8_t(operand))) { err = Error::INTERNAL_ERROR; return false; }
-
-                uint32_t x = 0;
-                uint64_t opsThisRow = 0;
-                while (x < W) {
-                    if (++opsThisRow > uint64_t(MAX_OPS_PER_ROW_FACTOR) * W) { err = Error::OP_COUNT_EXCEEDED; return false; }
-
-                    if (bg_mode != BG_SAVE_ALL && c < h.ncolors && pixel_is_background(img, x, y)) {
-                        uint32_t start = x;
-                        while (x < W && pixel_is_background(img, x, y) && (x - start) < 65535) ++x;
-                        uint32_t span = x - start;
-                        if (span >= 2) {
-                            if (span <= 255) {
-                                if (!write_u8(f, OPC_SKIP_PIXELS) || !write_u8(f, uint8_t(span))) { err = Error::INTERNAL_ERROR; return false; }
-                            } else {
-                                if (!write_u8(f, OPC_SKIP_PIXELS | OPC_LONG_FLAG) || !write_u8(f, 0) || !write_u16_le(f, uint16_t(span))) { err = Error::INTERNAL_ERROR; return false; }
-                            }
-                            continue;
-                        } else {
-                            x = start;
-                        }
-                    }
+    /* Emit the SET_COLOR/SKIP_PIXELS/RUN_DATA/BYTE_DATA opcodes of the row
+     * last staged by stage_row() ('h' as returned by stream_header()). */
+    static bool encode_row(ByteSink& out, const Header& h, Strategy strategy,
+                           Scratch& scratch, Error& err) {
+        const uint32_t W = h.width();
+        const uint8_t chans = h.channels();
+        const uint8_t* bg = scratch.bg.data();
 
-                    uint8_t v = img.pixel(x, y)[c];
-                    uint32_t run_len = 1;
-                    while (x + run_len < W && img.pixel(x + run_len, y)[c] == v && run_len < 65535) ++run_len;
-                    if (run_len >= 3) {
-                        uint32_t encoded = run_len - 1;
-                        if (encoded <= 255) {
-                            if (!write_u8(f, OPC_RUN_DATA) || !write_u8(f, uint8_t(encoded))) { err = Error::INTERNAL_ERROR; return false; }
-                        } else {
-                            if (!write_u8(f, OPC_RUN_DATA | OPC_LONG_FLAG) || !write_u8(f, 0) || !write_u16_le(f, uint16_t(encoded))) { err = Error::INTERNAL_ERROR; return false; }
-                        }
-                        if (!write_u16_le(f, uint16_t(v))) { err = Error::INTERNAL_ERROR; return false; }
-                        x += run_len;
+        for (uint8_t c = 0; c < chans; ++c) {
+            const uint8_t* plane = scratch.planes.data() + size_t(c) * W;
+            const bool can_skip = scratch.has_bg && c < h.ncolors;
+            if (strategy == MAX_COMPRESSION) {
+                encode_channel_optimal(out, h, c, plane, can_skip ? bg : nullptr, scratch);
+                continue;
+            }
+            uint16_t operand = (c == h.ncolors && h.has_alpha()) ? 255 : c;
+            out.put(OPC_SET_COLOR); out.put(uint8_t(operand));
+
+            uint32_t x = 0;
+            uint64_t opsThisRow = 0;
+            while (x < W) {
+                if (++opsThisRow > uint64_t(MAX_OPS_PER_ROW_FACTOR) * W) { err = Error::OP_COUNT_EXCEEDED; return false; }
+
+                const uint32_t left = W - x;
+                if (can_skip && bg[x]) {
+                    uint32_t span = scan_run(bg + x, left < 65535 ? left : 65535);
+                    if (span >= 2) {
+                        put_opcode(out, OPC_SKIP_PIXELS, span);
+                        x += span;
                         continue;
                     }
+                }
 
-                    std::vector<uint8_t> lit;
-                    lit.reserve(256);
-                    while (x < W) {
-                        uint8_t pv = img.pixel(x, y)[c];
-                        uint32_t look = 1;
-                        while (x + look < W && img.pixel(x + look, y)[c] == pv && look < 3) ++look;
-                        if (look >= 3) break;
-                        lit.push_back(pv);
-                        ++x;
-                        if (lit.size() == 256) break;
-                    }
-                    if (lit.empty()) continue;
-                    uint32_t count = uint32_t(lit.size());
-                    uint32_t encoded = count - 1;
-                    if (encoded <= 255) {
-                        if (!write_u8(f, OPC_BYTE_DATA) || !write_u8(f, uint8_t(encoded))) { err = Error::INTERNAL_ERROR; return false; }
-                    } else {
-                        if (!write_u8(f, OPC_BYTE_DATA | OPC_LONG_FLAG) || !write_u8(f, 0) || !write_u16_le(f, uint16_t(encoded))) { err = Error::INTERNAL_ERROR; return false; }
-                    }
-                    for (uint8_t pv : lit)
-                        if (!write_u8(f, pv)) { err = Error::INTERNAL_ERROR; return false; }
-                    if (count & 1)
-                        if (!write_u8(f, 0)) { err = Error::INTERNAL_ERROR; return false; }
+                uint32_t run_len = scan_run(plane + x, left < 65535 ? left : 65535);
+                if (run_len >= 3) {
+                    put_opcode(out, OPC_RUN_DATA, run_len - 1);
+                    out.put_u16_le(uint16_t(plane[x]));
+                    x += run_len;
+                    continue;
+                }
+
+                /* Literal up to the next run of 3 (which may start on the
+                 * last literal byte, hence the +2).  Past 256 bytes one
+                 * long-form opcode is never larger than several short ones
+                 * and saves their dispatch, so take up to the 65536 limit. */
+                uint32_t count = scan_triple(plane + x, left < 65538 ? left : 65538);
+                if (count > 65536) count = 65536;
+                if (count > left) count = left;
+                put_opcode(out, OPC_BYTE_DATA, count - 1);
+                out.write(plane + x, count);
+                if (count & 1) out.put(0);
+                x += count;
+            }
+        }
+        if (!out.ok()) { err = out.failure(); return false; }
+        return true;
+    }
+
+    /*
+     * Byte-minimal parse of one channel of a scanline (MAX_COMPRESSION).
+     * cost[i] is the cheapest encoding of plane[i, W), computed right to
+     * left.  It never increases with i (dropping the first pixel of an
+     * opcode never costs more), so a run or skip from i only needs its
+     * longest reach in each operand form.  A literal i..k costs its header
+     * plus (k - i) plus a filler when k - i is odd, so the best k is the
+     * minimum of cost[k] + k over the reachable window, kept per parity of
+     * k in monotonic queues.  'bg_mask' is null where skipping is not
+     * allowed.  Background at the end of the row costs
+     * nothing because the next SET_COLOR resets the position; a colour
+     * channel that is all background drops its SET_COLOR as well (except
+     * channel 0, which marks the scanline).
+     */
+    static void encode_channel_optimal(ByteSink& out, const Header& h, uint8_t c, const uint8_t* plane,
+                                       const uint8_t* bg_mask, Scratch& s) {
+        enum { END = 0, SKIP, RUN, LITERAL };
+        const uint32_t W = h.width();
+        uint32_t* cost = s.cost.data();
+        uint32_t* next = s.next.data();
+        uint8_t* kind = s.kind.data();
+
+        /* Queues of k with increasing cost[k] + k, by [form][k & 1]; the
+         * short form reaches 256 literal bytes, the long form 65536 */
+        struct Window { uint32_t* q; uint32_t head, tail; };
+        Window win[2][2];
+        for (int f = 0; f < 2; ++f)
+            for (int p = 0; p < 2; ++p) {
+                Window w = { s.window.data() + size_t(2 * f + p) * (W + 1), 0, 0 };
+                win[f][p] = w;
+            }
+        const uint32_t reach[2] = { 256, 65536 };
+        const uint32_t header[2] = { 2, 4 };
+
+        cost[W] = 0;
+        kind[W] = END;
+        bool tail_bg = bg_mask != nullptr, prev_bg = false;
+        uint32_t run_end = W, bg_end = W;
+        for (uint32_t i = W; i-- > 0; ) {
+            /* k = i + 1 enters every window; k > i + reach leaves */
+            const uint32_t k_in = i + 1;
+            const uint64_t e_in = uint64_t(cost[k_in]) + k_in;
+            for (int f = 0; f < 2; ++f) {
+                Window& w = win[f][k_in & 1];
+                while (w.tail > w.head && uint64_t(cost[w.q[w.tail - 1]]) + w.q[w.tail - 1] >= e_in) --w.tail;
+                w.q[w.tail++] = k_in;
+                for (int p = 0; p < 2; ++p) {
+                    Window& v = win[f][p];
+                    while (v.tail > v.head && v.q[v.head] - i > reach[f]) ++v.head;
+                }
+            }
+
+            if (i + 1 < W && plane[i] != plane[i + 1]) run_end = i + 1;
+            const bool bg = bg_mask && bg_mask[i];
+            if (bg && !prev_bg) bg_end = i + 1;
+            prev_bg = bg;
+            tail_bg = tail_bg && bg;
+            if (tail_bg) { cost[i] = 0; kind[i] = END; next[i] = W; continue; }
+
+            uint64_t best = ~uint64_t(0);
+            auto consider = [&](uint8_t k_kind, uint32_t k, uint64_t total) {
+                if (total < best) { best = total; kind[i] = k_kind; next[i] = k; }
+            };
+            if (bg) {
+                uint32_t k = (bg_end - i > 255) ? i + 255 : bg_end;
+                consider(SKIP, k, 2 + uint64_t(cost[k]));
+                k = (bg_end - i > 65535) ? i + 65535 : bg_end;
+                consider(SKIP, k, ((k - i > 255) ? 4 : 2) + uint64_t(cost[k]));
+            }
+            uint32_t k = (run_end - i > 256) ? i + 256 : run_end;
+            consider(RUN, k, 4 + uint64_t(cost[k]));
+            k = (run_end - i > 65536) ? i + 65536 : run_end;
+            consider(RUN, k, ((k - i > 256) ? 6 : 4) + uint64_t(cost[k]));
+            for (int f = 0; f < 2; ++f)
+                for (int p = 0; p < 2; ++p) {
+                    const Window& w = win[f][p];
+                    if (w.tail == w.head) continue;
+                    k = w.q[w.head];
+                    const uint32_t n = k - i;
+                    consider(LITERAL, k, header[f] + uint64_t(n) + (n & 1) + cost[k]);
                 }
+            cost[i] = uint32_t(best);
+        }
+
+        if (c != 0 && kind[0] == END) return;
+        const uint16_t operand = (c == h.ncolors && h.has_alpha()) ? 255 : c;
+        out.put(OPC_SET_COLOR); out.put(uint8_t(operand));
+        for (uint32_t i = 0; i < W && kind[i] != END; i = next[i]) {
+            const uint32_t n = next[i] - i;
+            switch (kind[i]) {
+                case SKIP:
+                    put_opcode(out, OPC_SKIP_PIXELS, n);
+                    break;
+                case RUN:
+                    put_opcode(out, OPC_RUN_DATA, n - 1);
+                    out.put_u16_le(uint16_t(plane[i]));
+                    break;
+                default:
+                    put_opcode(out, OPC_BYTE_DATA, n - 1);
+                    out.write(plane + i, n);
+                    if (n & 1) out.put(0);
+                    break;
             }
-            ++y;
         }
+    }
+};
 
-        if (!write_u8(f, OPC_EOF) || !write_u8(f, 0)) { err = Error::INTERNAL_ERROR; return false; }
+/*
+ * Incremental row-push encoder.
+ *
+ * begin() writes the header, each push_row() emits that scanline's opcodes
+ * immediately, and consecutive background rows are coalesced into
+ * SKIP_LINES exactly as Encoder::write does, so the stream is
+ * byte-identical.  Only the caller's current row is ever held; rows are
+ * pushed in order, each 'width * channels' interleaved bytes.  finish()
+ * fails unless all header.height() rows were pushed.
+ */
+class StreamEncoder {
+public:
+    explicit StreamEncoder(ByteSink& out) : out_(&out) {}
+    explicit StreamEncoder(FILE* f) : own_(new ByteSink(f)), out_(own_.get()) {}
+    explicit StreamEncoder(std::vector<uint8_t>& out) : own_(new ByteSink(out)), out_(own_.get()) {}
+
+    StreamEncoder(const StreamEncoder&) = delete;
+    StreamEncoder& operator=(const StreamEncoder&) = delete;
+
+    bool begin(const Header& h, Encoder::BackgroundMode bg_mode, Error& err) {
+        if (started_) { err = Error::INTERNAL_ERROR; return false; }
+        h_ = Encoder::stream_header(h, bg_mode);
+        mode_ = bg_mode;
+        if (!write_header(*out_, h_)) { err = out_->ok() ? Error::INTERNAL_ERROR : out_->failure(); return false; }
+        body_start_ = out_->tell();
+        /* All per-row work runs on this scratch; nothing is allocated per row */
+        try { scratch_.reserve(h_, strategy_); }
+        catch (...) { err = Error::ALLOC_TOO_LARGE; return false; }
+        started_ = true;
         err = Error::OK; return true;
     }
+
+    /* Record a RowIndex entry every 'step' rows while encoding (call
+     * before begin()).  The table is available from row_index(). */
+    void track_rows(uint32_t step) { index_.step = step; }
+
+    /* Opcode selection for the rows that follow (call before begin()). */
+    void set_strategy(Encoder::Strategy strategy) { strategy_ = strategy; }
+    const RowIndex& row_index() const { return index_; }
+    uint64_t body_offset() const { return body_start_; }
+
+    bool push_row(const uint8_t* row, Error& err) { return push_row(row, 0, err); }
+
+    /* Push a row whose pixels are 'pixel_stride' bytes apart (at least
+     * channels(); 0 means packed), e.g. RGBX for a 3-colour header. */
+    bool push_row(const uint8_t* row, size_t pixel_stride, Error& err) {
+        if (!started_ || finished_ || !row || y_ >= h_.height() ||
+            (pixel_stride && pixel_stride < h_.channels())) { err = Error::INTERNAL_ERROR; return false; }
+        const uint32_t y = y_++;
+        if (Encoder::stage_row(h_, row, mode_, strategy_, scratch_, pixel_stride)) {
+            if (!pending_skip_) { run_offset_ = out_->tell() - body_start_; run_row_ = y; }
+            mark_row(y, run_offset_, run_row_);
+            if (++pending_skip_ == 65535) flush_skip();
+            err = Error::OK; return true;
+        }
+        flush_skip();
+        mark_row(y, out_->tell() - body_start_, y);
+        if (!Encoder::encode_row(*out_, h_, strategy_, scratch_, err)) return false;
+        err = Error::OK; return true;
+    }
+
+    bool finish(Error& err) {
+        if (!started_ || finished_ || y_ != h_.height()) { err = Error::INTERNAL_ERROR; return false; }
+        flush_skip();
+        out_->put(OPC_EOF); out_->put(0);
+        index_.length = out_->tell() - body_start_;
+        finished_ = true;
+        if (!out_->flush()) { err = out_->failure(); return false; }
+        err = Error::OK; return true;
+    }
+
+    const Header& header() const { return h_; }
+    uint32_t rows_pushed() const { return y_; }
+
+private:
+    void flush_skip() {
+        if (pending_skip_) put_opcode(*out_, OPC_SKIP_LINES, pending_skip_);
+        pending_skip_ = 0;
+    }
+    void mark_row(uint32_t y, uint64_t offset, uint32_t resume_row) {
+        if (!index_.step || y % index_.step) return;
+        index_.offset.push_back(offset);
+        index_.row.push_back(resume_row);
+    }
+
+    std::unique_ptr<ByteSink> own_;
+    ByteSink* out_;
+    Header h_;
+    Encoder::BackgroundMode mode_ = Encoder::BG_SAVE_ALL;
+    uint32_t y_ = 0;
+    uint32_t pending_skip_ = 0;
+    uint64_t body_start_ = 0;
+    RowIndex index_;
+    Encoder::Strategy strategy_ = Encoder::GREEDY;
+    Encoder::Scratch scratch_;
+    uint64_t run_offset_ = 0;
+    uint32_t run_row_ = 0;
+    bool started_ = false;
+    bool finished_ = false;
 };
 
+inline bool Encoder::write_parallel(ByteSink& out, const Image& img, BackgroundMode bg_mode,
+                                    unsigned threads, Error& err) {
+    const uint64_t need = uint64_t(img.header.width()) * img.header.height() * img.header.channels();
+    if (img.pixels.size() < need) { err = Error::INTERNAL_ERROR; return false; }
+    return write_parallel(out, ImageView(img), bg_mode, threads, err);
+}
+
+inline bool Encoder::write_parallel(ByteSink& out, const ImageView& view, BackgroundMode bg_mode,
+                                    unsigned threads, Error& err) {
+#ifdef RLE_NO_THREADS
+    (void)threads;
+    return write(out, view, bg_mode, err);
+#else
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    const uint32_t H = view.header.height();
+    if (threads <= 1 || H < 2) return write(out, view, bg_mode, err);
+    if (!view.usable(err)) return false;
+    const size_t pixel_stride = view.pixel_step();
+
+    const Header h = stream_header(view.header, bg_mode);
+    if (!write_header(out, h)) { err = out.ok() ? Error::INTERNAL_ERROR : out.failure(); return false; }
+
+    /* Several bands per worker keeps the pool busy when row cost varies */
+    struct Band {
+        std::vector<uint8_t> bytes;
+        std::vector<size_t> row_end;     /* end offset of each row in 'bytes' */
+        std::vector<uint8_t> skippable;
+        Error err = Error::OK;
+    };
+    uint32_t band_rows = (H + threads * 4 - 1) / (threads * 4);
+    if (band_rows < 16) band_rows = 16;
+    const uint32_t nbands = (H + band_rows - 1) / band_rows;
+    std::vector<Band> bands(nbands);
+
+    /* An exception escaping a worker thread would terminate the process,
+     * so allocation failures land in band.err for the join loop */
+    auto encode_band = [&](uint32_t b) {
+        Band& band = bands[b];
+        const uint32_t y0 = b * band_rows;
+        const uint32_t y1 = (y0 + band_rows < H) ? y0 + band_rows : H;
+        try {
+            band.row_end.reserve(y1 - y0);
+            band.skippable.reserve(y1 - y0);
+            ByteSink sink(band.bytes);
+            Scratch scratch;
+            scratch.reserve(h, GREEDY);
+            for (uint32_t y = y0; y < y1; ++y) {
+                bool skip = stage_row(h, view.row(y), bg_mode, GREEDY, scratch, pixel_stride);
+                if (!skip && !encode_row(sink, h, GREEDY, scratch, band.err)) return;
+                band.skippable.push_back(skip ? 1 : 0);
+                band.row_end.push_back(size_t(sink.tell()));
+            }
+            if (!sink.flush()) band.err = sink.failure();
+        } catch (...) { band.err = Error::ALLOC_TOO_LARGE; }
+    };
+
+    std::atomic<uint32_t> next(0);
+    auto worker = [&]() {
+        for (uint32_t b = next++; b < nbands; b = next++) encode_band(b);
+    };
+    std::vector<std::thread> pool;
+    try {
+        for (unsigned i = 1; i < threads && i < nbands; ++i) pool.emplace_back(worker);
+    } catch (...) { /* fewer workers; the calling thread picks up the rest */ }
+    worker();
+    for (auto& t : pool) t.join();
+
+    uint32_t pending_skip = 0;
+    for (const Band& band : bands) {
+        if (band.err != Error::OK) { err = band.err; return false; }
+        size_t start = 0;
+        for (size_t i = 0; i < band.row_end.size(); ++i) {
+            if (band.skippable[i]) {
+                if (++pending_skip == 65535) { put_opcode(out, OPC_SKIP_LINES, pending_skip); pending_skip = 0; }
+                continue;
+            }
+            if (pending_skip) { put_opcode(out, OPC_SKIP_LINES, pending_skip); pending_skip = 0; }
+            out.write(band.bytes.data() + start, band.row_end[i] - start);
+            start = band.row_end[i];
+        }
+        if (!out.ok()) { err = out.failure(); return false; }
+    }
+    if (pending_skip) put_opcode(out, OPC_SKIP_LINES, pending_skip);
+    out.put(OPC_EOF); out.put(0);
+    if (!out.ok()) { err = out.failure(); return false; }
+    err = Error::OK; return true;
+#endif /* RLE_NO_THREADS */
+}
+
+inline bool Encoder::write_indexed(ByteSink& out, const Image& img, BackgroundMode bg_mode,
+                                   uint32_t step, Error& err) {
+    const uint64_t need = uint64_t(img.header.width()) * img.header.height() * img.header.channels();
+    if (img.pixels.size() < need) { err = Error::INTERNAL_ERROR; return false; }
+    /* parse() rejects a step past the height.  The default halves until
+     * a short image still gets a second band to seek to. */
+    const uint32_t H = img.header.height();
+    if (step == 0)
+        for (step = RowIndex::DEFAULT_STEP; step > 1 && step >= H; step /= 2) {}
+    if (step > H) step = H > 1 ? H : 1;
+
+    std::vector<uint8_t> staged;
+    RowIndex index;
+    size_t body_start;
+    {
+        StreamEncoder enc(staged);
+        enc.track_rows(step);
+        if (!enc.begin(img.header, bg_mode, err)) return false;
+        for (uint32_t y = 0; y < img.header.height(); ++y)
+            if (!enc.push_row(img.pixel(0, y), err)) return false;
+        if (!enc.finish(err)) return false;
+        index = enc.row_index();
+        body_start = size_t(enc.body_offset());
+    }
+
+    Header h = stream_header(img.header, bg_mode);
+    const std::string key(RowIndex::key());
+    std::vector<std::string> base;
+    for (const std::string& c : h.comments)
+        if (c.compare(0, key.size(), key) != 0) base.push_back(c);
+    for (;;) {
+        index.seal(staged.data() + body_start);
+        h.comments = base;
+        h.comments.push_back(index.to_comment());
+        if (pack_comments(h.comments).size() <= MAX_COMMENT_LEN) break;
+        if (!index.coarsen(H)) { h.comments = base; break; }
+    }
+    if (h.comments.empty()) h.flags &= ~FLAG_COMMENT;
+    else h.flags |= FLAG_COMMENT;
+
+    if (!write_header(out, h)) { err = out.ok() ? Error::INTERNAL_ERROR : out.failure(); return false; }
+    out.write(staged.data() + body_start, staged.size() - body_start);
+    if (!out.ok()) { err = out.failure(); return false; }
+    err = Error::OK; return true;
+}
+
+inline bool Encoder::write(ByteSink& out, const Image& img, BackgroundMode bg_mode,
+                           Strategy strategy, Error& err) {
+    const uint64_t need = uint64_t(img.header.width()) * img.header.height() * img.header.channels();
+    if (img.pixels.size() < need) { err = Error::INTERNAL_ERROR; return false; }
+    StreamEncoder enc(out);
+    enc.set_strategy(strategy);
+    if (!enc.begin(img.header, bg_mode, err)) return false;
+    for (uint32_t y = 0; y < img.header.height(); ++y)
+        if (!enc.push_row(img.pixel(0, y), err)) return false;
+    return enc.finish(err);
+}
+
+inline bool Encoder::write(ByteSink& out, const ImageView& view, BackgroundMode bg_mode,
+                           Strategy strategy, Error& err) {
+    if (!view.usable(err)) return false;
+    const size_t pixel_stride = view.pixel_step();
+    StreamEncoder enc(out);
+    enc.set_strategy(strategy);
+    if (!enc.begin(view.header, bg_mode, err)) return false;
+    for (uint32_t y = 0; y < view.header.height(); ++y)
+        if (!enc.push_row(view.row(y), pixel_stride, err)) return false;
+    return enc.finish(err);
+}
+
 struct DecoderResult {
     bool   ok = false;
     Error  error = Error::OK;
@@ -562,120 +1881,582 @@ struct DecoderResult {
 class Decoder {
 public:
     static DecoderResult read(FILE* f, Image& img) {
+        if (!f) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(f);
+        return read(src, img);
+    }
+
+    /* Decode straight out of a caller-owned byte span (network message,
+     * archive member, ...).  Every read is bounds checked against len; a
+     * short buffer reports the same errors a short file would. */
+    static DecoderResult read_memory(const uint8_t* data, size_t len, Image& img) {
+        if (!data && len) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(data, len);
+        return read(src, img);
+    }
+
+    /* Decode a whole file through MappedFile.  Truncated files report the
+     * same TRUNCATED_OPCODE/HEADER_TRUNCATED errors as the FILE* path. */
+    static DecoderResult read_file(const char* path, Image& img) {
+        MappedFile map;
+        if (!map.open(path)) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        return read_memory(map.data(), map.size(), img);
+    }
+
+#ifdef RLE_HAVE_MMAP
+    static DecoderResult read_fd(int fd, Image& img) {
+        MappedFile map;
+        if (!map.open_fd(fd)) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        return read_memory(map.data(), map.size(), img);
+    }
+#endif
+
+    static DecoderResult read(ByteSource& src, Image& img) {
+        DecoderResult res;
+        Header h; Endian e; Error herr;
+        if (!read_header_auto(src, h, e, herr)) { res.error = herr; return res; }
+        img.header = h;
+        Error aerr;
+        if (!img.allocate(aerr)) { res.error = aerr; return res; }
+
+        ImageTarget t(img);
+        return finish(decode_opcodes(src, h, e, t), e);
+    }
+
+    /*
+     * Decode into per-channel planes instead of interleaved pixels.  The
+     * stream is channel-major within each scanline, so RUN_DATA becomes a
+     * memset and BYTE_DATA a memcpy into the current plane row.  Errors
+     * and partially decoded content match read().
+     */
+    static DecoderResult read_planar(FILE* f, PlanarImage& img) {
+        if (!f) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(f);
+        return read_planar(src, img);
+    }
+
+    static DecoderResult read_planar_memory(const uint8_t* data, size_t len, PlanarImage& img) {
+        if (!data && len) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(data, len);
+        return read_planar(src, img);
+    }
+
+    static DecoderResult read_planar(ByteSource& src, PlanarImage& img) {
+        DecoderResult res;
+        Header h; Endian e; Error herr;
+        if (!read_header_auto(src, h, e, herr)) { res.error = herr; return res; }
+        img.header = h;
+        Error aerr;
+        if (!img.allocate(aerr)) { res.error = aerr; return res; }
+
+        PlanarTarget t = { img.planes.data(), img.plane_size(), h.width() };
+        return finish(decode_opcodes(src, h, e, t), e);
+    }
+
+    /*
+     * Decode through a caller-supplied pixel sink, so pixels can land in
+     * foreign storage (another sample type, a framebuffer) without an
+     * intermediate Image.  Once the header is read into 'h',
+     * sink.begin(h) is called; it returns false to fail with
+     * ALLOC_TOO_LARGE and must otherwise leave every pixel initialised as
+     * Image::allocate would (or do so before rows are reported final).
+     * The sink then receives the same calls as the internal targets, with
+     * spans clipped to the image and to a valid channel (alpha is channel
+     * h.ncolors), and rows in increasing order:
+     *   void run(uint32_t y, uint32_t x, int ch, uint8_t v, uint32_t n);
+     *   void literal(uint32_t y, uint32_t x, int ch, const uint8_t* p, uint32_t n);
+     *   void rows_done(uint32_t y_end, int ch);   // rows below y_end are final
+     * rows_done(h.height(), -1) closes a successful decode.
+     */
+    template <class Sink>
+    static DecoderResult read_sink(FILE* f, Header& h, Sink& sink) {
+        if (!f) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(f);
+        return read_sink(src, h, sink);
+    }
+
+    template <class Sink>
+    static DecoderResult read_sink(ByteSource& src, Header& h, Sink& sink) {
+        DecoderResult res;
+        Endian e; Error herr;
+        if (!read_header_auto(src, h, e, herr)) { res.error = herr; return res; }
+        if (!sink.begin(static_cast<const Header&>(h))) { res.error = Error::ALLOC_TOO_LARGE; return res; }
+        return finish(decode_opcodes(src, h, e, sink), e);
+    }
+
+    /*
+     * Scanline-streaming decode.  Instead of materialising Image::pixels,
+     * a single interleaved row buffer (width * channels bytes, initialised
+     * like Image::allocate) is kept and on_row(y, row) is invoked once per
+     * scanline, in order, as soon as the opcode stream completes it.
+     * Rows skipped by SKIP_LINES or left unwritten at EOF are delivered as
+     * background rows.  'h' is filled in before the first callback.  The
+     * row pointer is only valid for the duration of the call.  Peak memory
+     * is O(width), so MAX_ALLOC_BYTES does not bound the image size here.
+     */
+    typedef std::function<void(uint32_t y, const uint8_t* row)> RowCallback;
+
+    static DecoderResult read_rows(FILE* f, Header& h, const RowCallback& on_row) {
+        if (!f) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(f);
+        return read_rows(src, h, on_row);
+    }
+
+    static DecoderResult read_rows(ByteSource& src, Header& h, const RowCallback& on_row) {
+        DecoderResult res;
+        Endian e; Error herr;
+        if (!read_header_auto(src, h, e, herr)) { res.error = herr; return res; }
+        if (!on_row) { res.error = Error::INTERNAL_ERROR; return res; }
+
+        RowTarget t(h, on_row);
+        if (!t.ok) { res.error = Error::ALLOC_TOO_LARGE; return res; }
+        return finish(decode_opcodes(src, h, e, t), e);
+    }
+
+    /*
+     * Streaming decode of scanlines [y0, y1) only.  If the header carries a
+     * RowIndex that matches the opcode body (RowIndex::matches()) and the
+     * source can seek, decoding starts at the band containing y0 instead of
+     * the first opcode; otherwise earlier rows are parsed but not
+     * delivered.  Decoding stops once y1 is complete.
+     */
+    static DecoderResult read_row_range(FILE* f, Header& h, uint32_t y0, uint32_t y1,
+                                        const RowCallback& on_row) {
+        if (!f) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(f);
+        return read_row_range(src, h, y0, y1, on_row);
+    }
+
+    static DecoderResult read_row_range(ByteSource& src, Header& h, uint32_t y0, uint32_t y1,
+                                        const RowCallback& on_row) {
+        DecoderResult res;
+        Endian e; Error herr;
+        if (!read_header_auto(src, h, e, herr)) { res.error = herr; return res; }
+        if (!on_row) { res.error = Error::INTERNAL_ERROR; return res; }
+        if (y1 > h.height()) y1 = h.height();
+        if (y0 >= y1) return finish(Error::OK, e);
+
+        const uint32_t start_row = seek_to_row(src, h, y0);
+
+        RowTarget t(h, on_row);
+        if (!t.ok) { res.error = Error::ALLOC_TOO_LARGE; return res; }
+        t.next = start_row;
+        t.first = y0;
+        t.height = y1;
+        return finish(decode_opcodes(src, h, e, t, start_row, -1, y1), e);
+    }
+
+    /*
+     * Region-of-interest decode of the window [x0, x1) x [y0, y1), in image
+     * coordinates (0,0 = first pixel of the first scanline).  Only the
+     * window is allocated: img.header describes it, with xpos/ypos moved to
+     * its placement.  Rows above the window are parsed without storing
+     * pixels (or seeked past via a RowIndex that matches the body, as for
+     * read_row_range()), spans outside the columns are dropped, and
+     * decoding stops after y1.  The window is clipped to the
+     * image; an empty window is an error, and so is a placement that no
+     * longer fits the 16-bit xpos/ypos fields (DIM_TOO_LARGE).
+     */
+    static DecoderResult read_region(FILE* f, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+                                     Image& img) {
+        if (!f) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(f);
+        return read_region(src, x0, y0, x1, y1, img);
+    }
+
+    static DecoderResult read_region_memory(const uint8_t* data, size_t len,
+                                            uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+                                            Image& img) {
+        if (!data && len) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(data, len);
+        return read_region(src, x0, y0, x1, y1, img);
+    }
+
+    static DecoderResult read_region(ByteSource& src, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+                                     Image& img) {
         DecoderResult res;
-        if (!f) { res.error = Error::INTERNAL_ERROR; return res; }
         Header h; Endian e; Error herr;
-        if (!read_header_auto(f, h, e, herr)) { res.error = herr; return res; }
+        if (!read_header_auto(src, h, e, herr)) { res.error = herr; return res; }
+        if (x1 > h.width()) x1 = h.width();
+        if (y1 > h.height()) y1 = h.height();
+        if (x0 >= x1 || y0 >= y1) { res.error = Error::INTERNAL_ERROR; return res; }
+        if (h.xpos + x0 > 0xFFFFu || h.ypos + y0 > 0xFFFFu) { res.error = Error::DIM_TOO_LARGE; return res; }
+
         img.header = h;
+        img.header.xpos = uint16_t(h.xpos + x0);
+        img.header.ypos = uint16_t(h.ypos + y0);
+        img.header.xlen = uint16_t(x1 - x0);
+        img.header.ylen = uint16_t(y1 - y0);
         Error aerr;
         if (!img.allocate(aerr)) { res.error = aerr; return res; }
 
+        const uint32_t start_row = seek_to_row(src, h, y0);
+        WindowTarget t(img, x0, y0);
+        return finish(decode_opcodes(src, h, e, t, start_row, -1, y1), e);
+    }
+
+    /*
+     * Two-phase parallel decode of an in-memory stream.  A serial
+     * opcode-only pass (operand lengths, no pixel stores) records where
+     * each scanline starts; worker threads (0 = hardware_concurrency())
+     * then decode disjoint row ranges straight into Image::pixels.  The
+     * result and error reporting match read_memory(); when the scan hits an
+     * error the stream is handed to read_memory() so the pixels decoded
+     * before the damage are the same too.
+     */
+    static DecoderResult read_memory_parallel(const uint8_t* data, size_t len, Image& img,
+                                              unsigned threads) {
+        DecoderResult res;
+        if (!data && len) { res.error = Error::INTERNAL_ERROR; return res; }
+        ByteSource src(data, len);
+        Header h; Endian e; Error herr;
+        if (!read_header_auto(src, h, e, herr)) { res.error = herr; return res; }
+        img.header = h;
+        Error aerr;
+        if (!img.allocate(aerr)) { res.error = aerr; return res; }
+
+        std::vector<RowMark> marks;
+        RowMark first = { src.tell(), 0, -1 };
+        marks.push_back(first);
+        ScanTarget scan = { src, marks };
+        Error serr = decode_opcodes(src, h, e, scan);
+        // A damaged stream is decoded serially so the valid prefix lands
+        // exactly as read_memory() would leave it
+        if (serr != Error::OK) return read_memory(data, len, img);
+
+#ifdef RLE_NO_THREADS
+        threads = 1;
+#else
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+#endif
+        if (threads == 0) threads = 1;
+
+        /* Pick chunk starts among the marks, a few chunks per worker */
+        const uint32_t H = h.height();
+        const uint32_t nchunks = threads * 4;
+        std::vector<size_t> starts;
+        for (size_t i = 0; i < marks.size() && marks[i].row < H; ++i) {
+            if (starts.empty() ||
+                uint64_t(marks[i].row) * nchunks >= uint64_t(H) * starts.size())
+                starts.push_back(i);
+        }
+
+        std::vector<Error> errs(starts.size(), Error::OK);
+        auto decode_chunk = [&](size_t k) {
+            const RowMark& m = marks[starts[k]];
+            uint32_t stop = (k + 1 < starts.size()) ? marks[starts[k + 1]].row : H;
+            ByteSource s(data, len);
+            s.seek(m.offset);
+            ImageTarget t(img);
+            errs[k] = decode_opcodes(s, h, e, t, m.row, m.channel, stop);
+        };
+
+#ifndef RLE_NO_THREADS
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t k = next++; k < starts.size(); k = next++) decode_chunk(k);
+        };
+        std::vector<std::thread> pool;
+        try {
+            for (unsigned i = 1; i < threads && i < starts.size(); ++i) pool.emplace_back(worker);
+        } catch (...) { /* fewer workers; the calling thread picks up the rest */ }
+        worker();
+        for (auto& t : pool) t.join();
+#else
+        for (size_t k = 0; k < starts.size(); ++k) decode_chunk(k);
+#endif
+        for (Error ce : errs)
+            if (ce != Error::OK) return finish(ce, e);
+        return finish(Error::OK, e);
+    }
+
+    static DecoderResult read_file_parallel(const char* path, Image& img, unsigned threads) {
+        MappedFile map;
+        if (!map.open(path)) { DecoderResult res; res.error = Error::INTERNAL_ERROR; return res; }
+        return read_memory_parallel(map.data(), map.size(), img, threads);
+    }
+
+private:
+    static DecoderResult finish(Error err, Endian e) {
+        DecoderResult res;
+        res.ok = (err == Error::OK);
+        res.error = err;
+        if (res.ok) res.endian = e;
+        return res;
+    }
+
+    /*
+     * Pixel targets for decode_opcodes().  The opcode walker hands them
+     * spans that are already clipped to the image and to a valid channel;
+     * rows_done(y_end, ch) reports that every row below y_end is final and
+     * that decoding resumes in channel ch (-1 after SKIP_LINES).
+     */
+    struct ImageTarget {
+        uint8_t* base;
+        size_t stride;
+        uint8_t chans;
+
+        explicit ImageTarget(Image& img)
+            : base(img.pixels.data()),
+              stride(size_t(img.header.width()) * img.header.channels()),
+              chans(img.header.channels()) {}
+
+        inline void run(uint32_t y, uint32_t x, int ch, uint8_t v, uint32_t n) {
+            uint8_t* d = base + y * stride + size_t(x) * chans + ch;
+            for (uint32_t i = 0; i < n; ++i) d[size_t(i) * chans] = v;
+        }
+        inline void literal(uint32_t y, uint32_t x, int ch, const uint8_t* p, uint32_t n) {
+            uint8_t* d = base + y * stride + size_t(x) * chans + ch;
+            for (uint32_t i = 0; i < n; ++i) d[size_t(i) * chans] = p[i];
+        }
+        inline void rows_done(uint32_t, int) {}
+    };
+
+    struct PlanarTarget {
+        uint8_t* base;
+        size_t plane_size;
+        size_t stride;
+
+        inline void run(uint32_t y, uint32_t x, int ch, uint8_t v, uint32_t n) {
+            std::memset(base + ch * plane_size + y * stride + x, v, n);
+        }
+        inline void literal(uint32_t y, uint32_t x, int ch, const uint8_t* p, uint32_t n) {
+            std::memcpy(base + ch * plane_size + y * stride + x, p, n);
+        }
+        inline void rows_done(uint32_t, int) {}
+    };
+
+    /* Clips spans to a window of the image before storing them. */
+    struct WindowTarget {
+        uint8_t* base;
+        size_t stride;
+        uint8_t chans;
+        uint32_t x0, y0, x1, y1;
+
+        WindowTarget(Image& win, uint32_t wx, uint32_t wy)
+            : base(win.pixels.data()),
+              stride(size_t(win.header.width()) * win.header.channels()),
+              chans(win.header.channels()),
+              x0(wx), y0(wy), x1(wx + win.header.width()), y1(wy + win.header.height()) {}
+
+        /* Clip [x, x + n) to the window columns; 'skip' is how many leading
+         * elements were dropped.  False if nothing is left. */
+        inline bool clip(uint32_t y, uint32_t& x, uint32_t& n, uint32_t& skip) const {
+            if (y < y0 || y >= y1 || x >= x1 || x + n <= x0) return false;
+            skip = (x < x0) ? x0 - x : 0;
+            x += skip; n -= skip;
+            if (x + n > x1) n = x1 - x;
+            return true;
+        }
+        inline void run(uint32_t y, uint32_t x, int ch, uint8_t v, uint32_t n) {
+            uint32_t skip;
+            if (!clip(y, x, n, skip)) return;
+            uint8_t* d = base + (y - y0) * stride + size_t(x - x0) * chans + ch;
+            for (uint32_t i = 0; i < n; ++i) d[size_t(i) * chans] = v;
+        }
+        inline void literal(uint32_t y, uint32_t x, int ch, const uint8_t* p, uint32_t n) {
+            uint32_t skip;
+            if (!clip(y, x, n, skip)) return;
+            p += skip;
+            uint8_t* d = base + (y - y0) * stride + size_t(x - x0) * chans + ch;
+            for (uint32_t i = 0; i < n; ++i) d[size_t(i) * chans] = p[i];
+        }
+        inline void rows_done(uint32_t, int) {}
+    };
+
+    struct RowTarget {
+        const RowCallback& on_row;
+        std::vector<uint8_t> row, blank;
+        uint32_t height;
+        uint8_t chans;
+        uint32_t next = 0;
+        uint32_t first = 0;     /* rows below 'first' are decoded but not delivered */
+        bool dirty = false;
+        bool ok = true;
+
+        RowTarget(const Header& h, const RowCallback& fn)
+            : on_row(fn), height(h.height()), chans(h.channels()) {
+            try {
+                blank.assign(size_t(h.width()) * chans, 0);
+                for (size_t i = 0; i < blank.size(); i += chans) {
+                    if (!h.no_background())
+                        for (size_t c = 0; c < h.ncolors && c < h.background.size(); ++c)
+                            blank[i + c] = h.background[c];
+                    if (h.has_alpha()) blank[i + h.ncolors] = 255;
+                }
+                row = blank;
+            } catch (...) { ok = false; }
+        }
+
+        inline void run(uint32_t, uint32_t x, int ch, uint8_t v, uint32_t n) {
+            uint8_t* d = row.data() + size_t(x) * chans + ch;
+            for (uint32_t i = 0; i < n; ++i) d[size_t(i) * chans] = v;
+            dirty = true;
+        }
+        inline void literal(uint32_t, uint32_t x, int ch, const uint8_t* p, uint32_t n) {
+            uint8_t* d = row.data() + size_t(x) * chans + ch;
+            for (uint32_t i = 0; i < n; ++i) d[size_t(i) * chans] = p[i];
+            dirty = true;
+        }
+        void rows_done(uint32_t y_end, int) {
+            if (y_end > height) y_end = height;
+            for (; next < y_end; ++next) {
+                if (next >= first) on_row(next, row.data());
+                if (dirty) { std::memcpy(row.data(), blank.data(), row.size()); dirty = false; }
+            }
+        }
+    };
+
+    /* If the header carries a RowIndex that matches the opcodes in 'src'
+     * (positioned just after the header), seek to the band holding row y
+     * and return the row that decoding resumes at; otherwise leave 'src'
+     * at the first opcode and return 0. */
+    static uint32_t seek_to_row(ByteSource& src, const Header& h, uint32_t y) {
+        RowIndex index;
+        if (!src.seekable() || !index.parse(h)) return 0;
+        const size_t k = y / index.step;
+        if (index.row[k] == 0) return 0;
+        const uint64_t body = src.tell();
+        if (index.matches(src, body, k) && src.seek(body + index.offset[k])) return index.row[k];
+        src.seek(body);
+        return 0;
+    }
+
+    /* Row boundary in the opcode stream: decoding may resume at 'offset'
+     * with the scanline at 'row' in channel 'channel'. */
+    struct RowMark {
+        uint64_t offset;
+        uint32_t row;
+        int channel;
+    };
+
+    /* Opcode-only pass: records the first RowMark for each new row. */
+    struct ScanTarget {
+        const ByteSource& src;
+        std::vector<RowMark>& marks;
+
+        inline void run(uint32_t, uint32_t, int, uint8_t, uint32_t) {}
+        inline void literal(uint32_t, uint32_t, int, const uint8_t*, uint32_t) {}
+        void rows_done(uint32_t y_end, int ch) {
+            if (y_end > marks.back().row) {
+                RowMark m = { src.tell(), y_end, ch };
+                marks.push_back(m);
+            }
+        }
+    };
+
+    /* Walk the opcode stream after the header, feeding pixels to 't'.
+     * A walk may also start mid-stream at a row boundary recorded by
+     * ScanTarget (start_row/start_channel) and stop once the scanline
+     * reaches stop_row. */
+    template <class Target>
+    static Error decode_opcodes(ByteSource& src, const Header& h, Endian e, Target& t,
+                                uint32_t start_row = 0, int start_channel = -1,
+                                uint32_t stop_row = MAX_DIM) {
         const uint32_t W = h.width();
         const uint32_t H = h.height();
         const uint32_t xmin = h.xpos;
         const uint32_t ymin = h.ypos;
+        const uint32_t xmax = xmin + W;
+        const uint32_t ymax = ymin + ((stop_row < H) ? stop_row : H);
         const uint8_t  chans = h.channels();
 
-        uint32_t scan_y = ymin;
-        int current_channel = -1;
+        uint32_t scan_y = ymin + start_row;
+        int current_channel = start_channel;
         uint32_t scan_x = xmin;
 
-        while (scan_y < ymin + H) {
+        while (scan_y < ymax) {
             uint8_t op0, op1;
-            if (!read_u8(f, op0)) break;
-            if (!read_u8(f, op1)) { res.error = Error::TRUNCATED_OPCODE; return res; }
+            if (!read_u8(src, op0)) break;
+            if (!read_u8(src, op1)) return Error::TRUNCATED_OPCODE;
             uint8_t base = op0 & ~OPC_LONG_FLAG;
             bool longForm = (op0 & OPC_LONG_FLAG) != 0;
 
             switch (base) {
                 case OPC_SKIP_LINES: {
                     uint16_t lines;
-                    if (longForm) { if (!read_u16(f, e, lines)) { res.error = Error::TRUNCATED_OPCODE; return res; } }
+                    if (longForm) { if (!read_u16(src, e, lines)) return Error::TRUNCATED_OPCODE; }
                     else lines = op1;
                     // If we were in the middle of a scanline, complete it first
                     if (current_channel >= 0) ++scan_y;
                     scan_y += lines; scan_x = xmin; current_channel = -1;
+                    t.rows_done(scan_y - ymin, -1);
                     continue;
                 }
                 case OPC_SET_COLOR: {
-                    if (longForm) { res.error = Error::OPCODE_UNKNOWN; return res; }
+                    if (longForm) return Error::OPCODE_UNKNOWN;
                     uint16_t ch = op1;
                     int new_channel = (ch == 255 && h.has_alpha()) ? h.ncolors : int(ch);
                     // If we're moving to channel 0 after having processed other channels,
                     // it means we've finished the previous scanline
                     if (new_channel == 0 && current_channel >= 0) {
                         ++scan_y;
+                        t.rows_done(scan_y - ymin, 0);
                     }
                     current_channel = new_channel;
                     scan_x = xmin;
                 } break;
                 case OPC_SKIP_PIXELS: {
                     uint16_t skip;
-                    if (longForm) { if (!read_u16(f, e, skip)) { res.error = Error::TRUNCATED_OPCODE; return res; } }
+                    if (longForm) { if (!read_u16(src, e, skip)) return Error::TRUNCATED_OPCODE; }
                     else skip = op1;
-                    scan_x += skip;
+                    // Saturate at the right edge; anything past it is discarded anyway
+                    scan_x = (xmax - scan_x > skip) ? scan_x + skip : xmax;
                 } break;
                 case OPC_BYTE_DATA: {
                     uint16_t enc;
-                    if (longForm) { if (!read_u16(f, e, enc)) { res.error = Error::TRUNCATED_OPCODE; return res; } }
+                    if (longForm) { if (!read_u16(src, e, enc)) return Error::TRUNCATED_OPCODE; }
                     else enc = op1;
                     uint32_t count = uint32_t(enc) + 1;
-                    uint32_t remaining = (xmin + W > scan_x) ? (xmin + W - scan_x) : 0;
+                    uint32_t remaining = xmax - scan_x;
                     uint32_t to_write = (count < remaining) ? count : remaining;
                     uint32_t to_discard = count - to_write;
-                    for (uint32_t i = 0; i < to_write; ++i) {
-                        uint8_t pv;
-                        if (!read_u8(f, pv)) { res.error = Error::TRUNCATED_OPCODE; return res; }
-                        if (current_channel >= 0 && current_channel < int(chans))
-                            img.pixel(scan_x - xmin, scan_y - ymin)[current_channel] = pv;
-                        ++scan_x;
-                    }
-                    for (uint32_t i = 0; i < to_discard; ++i) {
-                        uint8_t tmp;
-                        if (!read_u8(f, tmp)) { res.error = Error::TRUNCATED_OPCODE; return res; }
-                        ++scan_x;
+                    const bool store = current_channel >= 0 && current_channel < int(chans);
+                    while (to_write > 0) {
+                        const uint8_t* p;
+                        size_t n = src.next_span(p, to_write);
+                        if (!n) return Error::TRUNCATED_OPCODE;
+                        if (store) t.literal(scan_y - ymin, scan_x - xmin, current_channel, p, uint32_t(n));
+                        scan_x += uint32_t(n); to_write -= uint32_t(n);
                     }
-                    if (count & 1) { uint8_t filler; if (!read_u8(f, filler)) { res.error = Error::TRUNCATED_OPCODE; return res; } }
+                    // Excess bytes land past the right edge; the filler pads odd counts
+                    if (!src.skip(uint64_t(to_discard) + (count & 1))) return Error::TRUNCATED_OPCODE;
                 } break;
                 case OPC_RUN_DATA: {
                     uint16_t enc;
-                    if (longForm) { if (!read_u16(f, e, enc)) { res.error = Error::TRUNCATED_OPCODE; return res; } }
+                    if (longForm) { if (!read_u16(src, e, enc)) return Error::TRUNCATED_OPCODE; }
                     else enc = op1;
                     uint32_t run_len = uint32_t(enc) + 1;
                     uint16_t word;
-                    if (!read_u16(f, e, word)) { res.error = Error::TRUNCATED_OPCODE; return res; }
+                    if (!read_u16(src, e, word)) return Error::TRUNCATED_OPCODE;
                     uint8_t pv = uint8_t(word & 0xFF);
-                    uint32_t remaining = (xmin + W > scan_x) ? (xmin + W - scan_x) : 0;
+                    uint32_t remaining = xmax - scan_x;
                     uint32_t to_write = (run_len < remaining) ? run_len : remaining;
-                    uint32_t to_skip = run_len - to_write;
-                    for (uint32_t i = 0; i < to_write; ++i) {
-                        if (current_channel >= 0 && current_channel < int(chans))
-                            img.pixel(scan_x - xmin, scan_y - ymin)[current_channel] = pv;
-                        ++scan_x;
-                    }
-                    scan_x += to_skip;
+                    if (to_write && current_channel >= 0 && current_channel < int(chans))
+                        t.run(scan_y - ymin, scan_x - xmin, current_channel, pv, to_write);
+                    scan_x += to_write;
                 } break;
                 case OPC_EOF:
-                    res.ok = true; res.error = Error::OK; res.endian = e; return res;
+                    t.rows_done(H, -1);
+                    return Error::OK;
                 default:
-                    res.error = Error::OPCODE_UNKNOWN; return res;
+                    return Error::OPCODE_UNKNOWN;
             }
         }
-        res.ok = true; res.error = Error::OK; res.endian = e; return res;
+        t.rows_done(H, -1);
+        return Error::OK;
     }
 };
 
 /* ----- Convenience RGB helpers ----- */
-inline bool write_rgb(FILE* f,
-                      const uint8_t* interleaved,
-                      uint32_t width,
-                      uint32_t height,
-                      const std::vector<std::string>& comments,
-                      const std::vector<uint8_t>& background,
-                      bool include_alpha,
-                      Encoder::BackgroundMode bg_mode,
-                      Error& err) {
-    Header h;
+/* Header write_rgb() encodes with: 8-bit RGB, alpha last when requested. */
+inline bool rgb_header(Header& h,
+                       uint32_t width,
+                       uint32_t height,
+                       const std::vector<std::string>& comments,
+                       const std::vector<uint8_t>& background,
+                       bool include_alpha,
+                       Error& err) {
     h.xpos = 0; h.ypos = 0;
     h.xlen = width; h.ylen = height;
     h.ncolors = 3;
@@ -689,26 +2470,141 @@ inline bool write_rgb(FILE* f,
 
     Error hv;
     if (!h.validate(hv)) { err = hv; return false; }
+    err = Error::OK;
+    return true;
+}
 
-    Image img;
-    img.header = h;
-    Error aerr;
-    if (!img.allocate(aerr)) { err = aerr; return false; }
+/* Encodes straight from 'interleaved' through an ImageView; nothing is
+ * copied. */
+inline bool write_rgb(ByteSink& out,
+                      const uint8_t* interleaved,
+                      uint32_t width,
+                      uint32_t height,
+                      const std::vector<std::string>& comments,
+                      const std::vector<uint8_t>& background,
+                      bool include_alpha,
+                      Encoder::BackgroundMode bg_mode,
+                      Error& err) {
+    ImageView view;
+    if (!rgb_header(view.header, width, height, comments, background, include_alpha, err)) return false;
+    view.data = interleaved;
+    return Encoder::write(out, view, bg_mode, err);
+}
+
+inline bool write_rgb(FILE* f,
+                      const uint8_t* interleaved,
+                      uint32_t width,
+                      uint32_t height,
+                      const std::vector<std::string>& comments,
+                      const std::vector<uint8_t>& background,
+                      bool include_alpha,
+                      Encoder::BackgroundMode bg_mode,
+                      Error& err) {
+    if (!f) { err = Error::INTERNAL_ERROR; return false; }
+    ByteSink out(f);
+    if (!write_rgb(out, interleaved, width, height, comments, background,
+                   include_alpha, bg_mode, err)) return false;
+    if (!out.flush()) { err = Error::INTERNAL_ERROR; return false; }
+    return true;
+}
+
+/* Memory variants of write_rgb; same contract as Encoder::write_memory. */
+inline bool write_rgb_memory(std::vector<uint8_t>& out,
+                             const uint8_t* interleaved,
+                             uint32_t width,
+                             uint32_t height,
+                             const std::vector<std::string>& comments,
+                             const std::vector<uint8_t>& background,
+                             bool include_alpha,
+                             Encoder::BackgroundMode bg_mode,
+                             Error& err) {
+    const size_t base = out.size();
+    bool ok;
+    {
+        ByteSink sink(out);
+        ok = write_rgb(sink, interleaved, width, height, comments, background,
+                       include_alpha, bg_mode, err) && sink.flush();
+    }
+    if (!ok) out.resize(base);
+    return ok;
+}
 
-    size_t pixCount = size_t(width) * height;
-    if (!include_alpha) {
-        std::memcpy(img.pixels.data(), interleaved, pixCount * 3);
+inline bool write_rgb_memory(uint8_t* buf, size_t cap, size_t& written,
+                             const uint8_t* interleaved,
+                             uint32_t width,
+                             uint32_t height,
+                             const std::vector<std::string>& comments,
+                             const std::vector<uint8_t>& background,
+                             bool include_alpha,
+                             Encoder::BackgroundMode bg_mode,
+                             Error& err) {
+    ByteSink sink(buf, cap);
+    bool ok = write_rgb(sink, interleaved, width, height, comments, background,
+                        include_alpha, bg_mode, err);
+    written = size_t(sink.tell());
+    return ok;
+}
+
+/*
+ * Reshape a decoded image to the RGB(A) layout read_rgb() returns: three
+ * colour channels, then alpha if present.  Extra colour channels are
+ * dropped (compacted in place) and missing ones read as 0, as in rle_read.
+ * Three-colour images are left untouched.
+ */
+inline bool to_rgb_layout(Image& img, Error& err) {
+    Header& h = img.header;
+    if (h.ncolors == 3) { err = Error::OK; return true; }
+    const size_t npix = size_t(h.width()) * h.height();
+    const size_t src_ch = h.channels();
+    const size_t keep = h.ncolors < 3 ? h.ncolors : 3;
+    const bool alpha = h.has_alpha();
+    const size_t dst_ch = alpha ? 4 : 3;
+    if (h.ncolors > 3) {
+        uint8_t* p = img.pixels.data();
+        for (size_t i = 0; i < npix; ++i) {
+            const uint8_t* s = p + i * src_ch;
+            uint8_t* d = p + i * dst_ch;
+            d[0] = s[0]; d[1] = s[1]; d[2] = s[2];
+            if (alpha) d[3] = s[h.ncolors];
+        }
+        img.pixels.resize(npix * dst_ch);
     } else {
-        for (size_t i = 0; i < pixCount; ++i) {
-            img.pixels[4*i+0] = interleaved[4*i+0];
-            img.pixels[4*i+1] = interleaved[4*i+1];
-            img.pixels[4*i+2] = interleaved[4*i+2];
-            img.pixels[4*i+3] = interleaved[4*i+3];
+        std::vector<uint8_t> rgb;
+        try {
+            rgb.assign(npix * dst_ch, 0);
+        } catch (...) { err = Error::ALLOC_TOO_LARGE; return false; }
+        const uint8_t* s = img.pixels.data();
+        for (size_t i = 0; i < npix; ++i, s += src_ch) {
+            uint8_t* d = rgb.data() + i * dst_ch;
+            for (size_t c = 0; c < keep; ++c) d[c] = s[c];
+            if (alpha) d[3] = s[h.ncolors];
         }
+        img.pixels.swap(rgb);
     }
-    return Encoder::write(f, img, bg_mode, err);
+    if (!h.no_background()) h.background.resize(3, 0);
+    h.ncolors = 3;
+    err = Error::OK;
+    return true;
 }
 
+/*
+ * Decode into 'out' with the RGB(A) layout of read_rgb(), keeping the
+ * header (background, comments, position).  Three-colour files are
+ * decoded in place; nothing is copied.
+ */
+inline bool read_rgb(FILE* f, Image& out, Error& err) {
+    Image img;
+    DecoderResult dr = Decoder::read(f, img);
+    if (!dr.ok) { err = dr.error; return false; }
+    if (!to_rgb_layout(img, err)) return false;
+    out = std::move(img);
+    return true;
+}
+
+/*
+ * The decoded pixel buffer is moved into 'interleaved' (its previous
+ * storage is released), so no image-sized copy is made for RGB(A) files.
+ */
 inline bool read_rgb(FILE* f,
                      std::vector<uint8_t>& interleaved,
                      uint32_t& width,
@@ -717,21 +2613,12 @@ inline bool read_rgb(FILE* f,
                      std::vector<std::string>* comments_out,
                      Error& err) {
     Image img;
-    DecoderResult dr = Decoder::read(f, img);
-    if (!dr.ok) { err = dr.error; return false; }
+    if (!read_rgb(f, img, err)) return false;
     width  = img.header.width();
     height = img.header.height();
-    if (comments_out) *comments_out = img.header.comments;
+    if (comments_out) *comments_out = std::move(img.header.comments);
     if (has_alpha_out) *has_alpha_out = img.header.has_alpha();
-
-    size_t pixCount = size_t(width) * height;
-    if (!img.header.has_alpha()) {
-        interleaved.resize(pixCount * 3);
-        std::memcpy(interleaved.data(), img.pixels.data(), pixCount * 3);
-    } else {
-        interleaved.resize(pixCount * 4);
-        std::memcpy(interleaved.data(), img.pixels.data(), pixCount * 4);
-    }
+    interleaved = std::move(img.pixels);
     err = Error::OK;
     return true;
 }
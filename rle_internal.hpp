@@ -0,0 +1,33 @@
+/*                   R L E _ I N T E R N A L . H P P
+ * BRL-CAD
+ *
+ * Declarations for the entry points rle.cpp defines.  rle_write and
+ * rle_read are the libicv API; the rle_* helpers below them expose single
+ * steps of those two for the test suite and bench_rle and are not meant
+ * for other callers.
+ */
+
+#ifndef RLE_INTERNAL_HPP
+#define RLE_INTERNAL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include "rle.hpp"   /* icv_image_t, rle::Encoder */
+
+int rle_write(icv_image_t *bif, FILE *fp);
+icv_image_t *rle_read(FILE *fp);
+void bu_free(void *ptr, const char *str);
+
+/* The double -> 8-bit conversion rle_write applies to icv data. */
+void rle_quantize_u8(const double *src, uint8_t *dst, size_t n);
+
+/* The 8-bit -> double expansion rle_read applies to decoded data. */
+void rle_expand_u8(const uint8_t *src, double *dst, size_t n);
+
+/* Background choice for a packed w x h RGB buffer; color is set unless the
+ * result is BG_SAVE_ALL. */
+rle::Encoder::BackgroundMode rle_detect_background(const uint8_t *rgb, size_t w, size_t h, uint8_t color[3]);
+
+#endif /* RLE_INTERNAL_HPP */
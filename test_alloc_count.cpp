@@ -0,0 +1,297 @@
+/*
+ * test_alloc_count.cpp - Heap allocation accounting for the encoder
+ *
+ * Replaces the global operator new/delete with counting versions and
+ * checks that encoding performs a fixed number of allocations per call:
+ * - Independent of image size and content (noise, runs, background)
+ * - Zero allocations per StreamEncoder::push_row()
+ * - No image-sized copies in write_rgb/read_rgb or ImageView encodes
+ * - Allocation failures on write_parallel's worker threads are reported
+ *
+ * Kept in its own executable because the replacement operators apply to
+ * the whole program.
+ */
+
+#include "rle.hpp"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+#include <vector>
+
+// Kept out of line: once inlined, GCC sees free() applied to memory from
+// operator new and reports -Wmismatched-new-delete
+#if defined(__GNUC__)
+#define COUNTING_OP __attribute__((noinline))
+#else
+#define COUNTING_OP
+#endif
+
+// Atomic because write_parallel allocates from its worker threads
+static std::atomic<size_t> g_allocs(0);
+static std::atomic<size_t> g_alloc_bytes(0);
+static std::atomic<size_t> g_fail_from(0);   // nonzero: requests this large throw
+
+COUNTING_OP void* operator new(std::size_t n) {
+    ++g_allocs;
+    g_alloc_bytes += n;
+    if (g_fail_from && n >= g_fail_from) throw std::bad_alloc();
+    void* p = std::malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+COUNTING_OP void* operator new[](std::size_t n) {
+    ++g_allocs;
+    g_alloc_bytes += n;
+    if (g_fail_from && n >= g_fail_from) throw std::bad_alloc();
+    void* p = std::malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+COUNTING_OP void operator delete(void* p) noexcept { std::free(p); }
+COUNTING_OP void operator delete[](void* p) noexcept { std::free(p); }
+COUNTING_OP void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+COUNTING_OP void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) \
+    static void name(); \
+    static void name##_wrapper() { \
+        tests_run++; \
+        printf("Running %s...", #name); \
+        fflush(stdout); \
+        name(); \
+        tests_passed++; \
+        printf(" PASSED\n"); \
+    } \
+    static void name()
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "\n  FAILED at line %d: %s\n", __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+// Helper: Image with a background color and noisy, run-heavy and empty areas
+static rle::Image create_noisy(uint32_t w, uint32_t h, bool alpha, uint32_t seed) {
+    rle::Image img;
+    img.header.xlen = uint16_t(w);
+    img.header.ylen = uint16_t(h);
+    img.header.ncolors = 3;
+    img.header.pixelbits = 8;
+    if (alpha) img.header.flags |= rle::FLAG_ALPHA;
+    img.header.background = {10, 20, 30};
+    rle::Error err;
+    CHECK(img.allocate(err));
+    for (uint32_t y = 0; y < h; y++) {
+        if (y % 5 == 2) continue;                         // background row
+        for (uint32_t x = 0; x < w; x++) {
+            seed = seed * 1103515245u + 12345u;
+            uint8_t* p = img.pixel(x, y);
+            if (x % 64 < 32)
+                for (uint8_t c = 0; c < img.header.channels(); c++) p[c] = uint8_t(seed >> (8 + c));
+            else if (x % 64 < 48)
+                for (uint8_t c = 0; c < img.header.channels(); c++) p[c] = uint8_t(y + c);
+        }
+    }
+    return img;
+}
+
+// Helper: Allocations made by one Encoder::write into a tmpfile
+static size_t allocs_for_file_encode(const rle::Image& img, rle::Encoder::BackgroundMode mode) {
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    rle::Error err;
+    size_t before = g_allocs;
+    CHECK(rle::Encoder::write(f, img, mode, err));
+    size_t used = g_allocs - before;
+    fclose(f);
+    return used;
+}
+
+//==============================================================================
+// ENCODER ALLOCATION TESTS
+//==============================================================================
+
+TEST(test_encode_allocs_independent_of_size) {
+    const rle::Encoder::BackgroundMode modes[] = {rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY,
+                                                  rle::Encoder::BG_CLEAR};
+    const bool alpha_modes[] = {false, true};
+    for (bool alpha : alpha_modes) {
+        for (auto mode : modes) {
+            rle::Image small = create_noisy(8, 4, alpha, 1);
+            rle::Image large = create_noisy(1500, 400, alpha, 2);
+            size_t a = allocs_for_file_encode(small, mode);
+            size_t b = allocs_for_file_encode(large, mode);
+            CHECK(a == b);
+            CHECK(b <= 16);
+
+            FILE* f = tmpfile();
+            CHECK(f != nullptr);
+            rle::Error err;
+            size_t before = g_allocs;
+            CHECK(rle::Encoder::write(f, small, mode, rle::Encoder::MAX_COMPRESSION, err));
+            size_t c = g_allocs - before;
+            rewind(f);
+            before = g_allocs;
+            CHECK(rle::Encoder::write(f, large, mode, rle::Encoder::MAX_COMPRESSION, err));
+            CHECK(g_allocs - before == c);
+            fclose(f);
+        }
+    }
+}
+
+TEST(test_encode_fixed_buffer_allocs) {
+    rle::Image small = create_noisy(16, 16, false, 3);
+    rle::Image large = create_noisy(1024, 512, false, 4);
+    std::vector<uint8_t> buf(8u << 20);
+    rle::Error err;
+    size_t written = 0;
+
+    size_t before = g_allocs;
+    CHECK(rle::Encoder::write_memory(buf.data(), buf.size(), written, small, rle::Encoder::BG_OVERLAY, err));
+    size_t a = g_allocs - before;
+    before = g_allocs;
+    CHECK(rle::Encoder::write_memory(buf.data(), buf.size(), written, large, rle::Encoder::BG_OVERLAY, err));
+    size_t b = g_allocs - before;
+    CHECK(a == b);
+}
+
+TEST(test_push_row_does_not_allocate) {
+    rle::Image img = create_noisy(777, 120, true, 5);
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    rle::Error err;
+    {
+        rle::StreamEncoder enc(f);
+        CHECK(enc.begin(img.header, rle::Encoder::BG_OVERLAY, err));
+        size_t before = g_allocs;
+        for (uint32_t y = 0; y < img.header.height(); y++) CHECK(enc.push_row(img.pixel(0, y), err));
+        CHECK(g_allocs == before);
+        CHECK(enc.finish(err));
+    }
+    fclose(f);
+}
+
+//==============================================================================
+// ZERO-COPY ENCODE AND DECODE TESTS
+//==============================================================================
+
+TEST(test_write_rgb_not_copied) {
+    rle::Image img = create_noisy(1500, 400, true, 6);
+    const size_t image_bytes = img.pixels.size();
+    std::vector<std::string> comments = {"SOFTWARE=test"};
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    rle::Error err;
+
+    size_t before = g_alloc_bytes;
+    CHECK(rle::write_rgb(f, img.pixels.data(), 1500, 400, comments, img.header.background, true,
+                         rle::Encoder::BG_OVERLAY, err));
+    CHECK(g_alloc_bytes - before < image_bytes / 4);
+    fclose(f);
+}
+
+TEST(test_image_view_encode_not_copied) {
+    rle::Image small = create_noisy(8, 4, true, 8);
+    rle::Image large = create_noisy(1500, 400, true, 9);
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    rle::Error err;
+
+    rle::ImageView packed(small.header, small.pixels.data());
+    size_t before = g_allocs;
+    CHECK(rle::Encoder::write(f, packed, rle::Encoder::BG_OVERLAY, err));
+    size_t a = g_allocs - before;
+    rewind(f);
+    rle::ImageView view(large.header, large.pixel(0, 399), -ptrdiff_t(1500 * 4));
+    before = g_allocs;
+    size_t before_bytes = g_alloc_bytes;
+    CHECK(rle::Encoder::write(f, view, rle::Encoder::BG_OVERLAY, err));
+    CHECK(g_allocs - before == a);
+    CHECK(g_alloc_bytes - before_bytes < large.pixels.size() / 4);
+    fclose(f);
+}
+
+TEST(test_read_rgb_not_copied) {
+    const bool alpha_modes[] = {false, true};
+    for (bool alpha : alpha_modes) {
+        rle::Image img = create_noisy(1500, 400, alpha, 7);
+        FILE* f = tmpfile();
+        CHECK(f != nullptr);
+        rle::Error err;
+        CHECK(rle::Encoder::write(f, img, rle::Encoder::BG_OVERLAY, err));
+
+        rewind(f);
+        rle::Image ref;
+        size_t before = g_alloc_bytes;
+        CHECK(rle::Decoder::read(f, ref).ok);
+        size_t decode_bytes = g_alloc_bytes - before;
+
+        rewind(f);
+        std::vector<uint8_t> rgb;
+        uint32_t w, h;
+        before = g_alloc_bytes;
+        CHECK(rle::read_rgb(f, rgb, w, h, nullptr, nullptr, err));
+        CHECK(g_alloc_bytes - before < decode_bytes + img.pixels.size() / 4);
+        CHECK(rgb == ref.pixels);
+        fclose(f);
+    }
+}
+
+//==============================================================================
+// ALLOCATION FAILURE TESTS
+//==============================================================================
+
+TEST(test_write_parallel_alloc_failure) {
+    // Each band's scratch holds a 36000-byte row, which is refused; the
+    // bands run on worker threads and on the calling thread
+    rle::Image img = create_noisy(12000, 64, false, 8);
+    std::vector<uint8_t> buf(4u << 20);
+    rle::ByteSink out(buf.data(), buf.size());
+    rle::Error err = rle::Error::OK;
+    g_fail_from = 32 * 1024;
+    bool ok = rle::Encoder::write_parallel(out, img, rle::Encoder::BG_OVERLAY, 4, err);
+    g_fail_from = 0;
+    CHECK(!ok);
+    CHECK(err == rle::Error::ALLOC_TOO_LARGE);
+
+    rle::ByteSink retry(buf.data(), buf.size());
+    CHECK(rle::Encoder::write_parallel(retry, img, rle::Encoder::BG_OVERLAY, 4, err));
+}
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+int main() {
+    printf("=== RLE Allocation Count Test Suite ===\n");
+
+    printf("\n--- Encoder Allocation Tests ---\n");
+    test_encode_allocs_independent_of_size_wrapper();
+    test_encode_fixed_buffer_allocs_wrapper();
+    test_push_row_does_not_allocate_wrapper();
+
+    printf("\n--- Zero-Copy Tests ---\n");
+    test_write_rgb_not_copied_wrapper();
+    test_image_view_encode_not_copied_wrapper();
+    test_read_rgb_not_copied_wrapper();
+
+    printf("\n--- Allocation Failure Tests ---\n");
+    test_write_parallel_alloc_failure_wrapper();
+
+    printf("\n=== Results ===\n");
+    printf("Tests passed: %d/%d\n", tests_passed, tests_run);
+
+    if (tests_passed == tests_run) {
+        printf("\n✅ All allocation count tests PASSED\n");
+        return 0;
+    } else {
+        printf("\n❌ Some tests FAILED\n");
+        return 1;
+    }
+}
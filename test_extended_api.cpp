@@ -0,0 +1,1551 @@
+/*
+ * test_extended_api.cpp - Tests for the extended codec entry points
+ *
+ * Exercises the APIs that sit beside the FILE*-based Encoder/Decoder:
+ * - Decoding from in-memory byte spans
+ * - Encoding into growable vectors and fixed caller buffers
+ * - write_rgb/read_rgb buffer hand-over and RGB(A) reshaping
+ * - Encoding from non-owning ImageViews (padded, strided, bottom-up)
+ * - Decoding whole files through MappedFile (mmap where available)
+ * - Scanline-streaming decode with a per-row callback
+ * - Incremental row-push encoding (StreamEncoder)
+ * - Band-parallel encoding
+ * - Parallel decoding from a pre-scanned row index
+ * - Embedded row-offset index and row-range decode
+ * - Region-of-interest (window) decode
+ * - Vectorized run/literal scanning, row de-interleaving and background
+ *   mask kernels
+ * - Planar (channel-separated) decode
+ * - Size-optimal (MAX_COMPRESSION) encoding
+ *
+ * Every test checks the alternate path against the reference FILE* path,
+ * so the two must agree on both pixels and error reporting.
+ */
+
+#include "rle.hpp"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) \
+    static void name(); \
+    static void name##_wrapper() { \
+        tests_run++; \
+        printf("Running %s...", #name); \
+        fflush(stdout); \
+        name(); \
+        tests_passed++; \
+        printf(" PASSED\n"); \
+    } \
+    static void name()
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "\n  FAILED at line %d: %s\n", __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+// Helper: Create and allocate an image, optionally with alpha and background
+static rle::Image create_image(uint32_t w, uint32_t h, bool alpha = false,
+                               const std::vector<uint8_t>& bg = std::vector<uint8_t>()) {
+    rle::Image img;
+    img.header.xlen = uint16_t(w);
+    img.header.ylen = uint16_t(h);
+    img.header.ncolors = 3;
+    img.header.pixelbits = 8;
+    if (alpha) img.header.flags |= rle::FLAG_ALPHA;
+    if (bg.empty()) img.header.flags |= rle::FLAG_NO_BACKGROUND;
+    else img.header.background = bg;
+    rle::Error err;
+    if (!img.allocate(err)) {
+        fprintf(stderr, "Failed to allocate image: %s\n", rle::error_string(err));
+        exit(1);
+    }
+    return img;
+}
+
+// Helper: Fill with a mix of noise, runs and background-colored spans
+static void fill_mixed(rle::Image& img, uint32_t seed) {
+    const uint32_t W = img.header.width();
+    const uint8_t chans = img.header.channels();
+    for (uint32_t y = 0; y < img.header.height(); y++) {
+        for (uint32_t x = 0; x < W; x++) {
+            seed = seed * 1103515245u + 12345u;
+            uint8_t* p = img.pixel(x, y);
+            if (y % 7 == 3) continue;                    // untouched (background) row
+            if (x < W / 4) {
+                for (uint8_t c = 0; c < chans; c++) p[c] = uint8_t(seed >> (8 + c));
+            } else if (x < W / 2) {
+                for (uint8_t c = 0; c < chans; c++) p[c] = uint8_t(y * 3 + c);
+            } else if ((seed >> 28) == 0) {
+                for (uint8_t c = 0; c < chans; c++) p[c] = uint8_t(seed >> 16);
+            }
+        }
+    }
+}
+
+// Helper: Encode through the FILE* path and return the encoded bytes
+static std::vector<uint8_t> encode_file(const rle::Image& img,
+                                        rle::Encoder::BackgroundMode mode = rle::Encoder::BG_SAVE_ALL) {
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    rle::Error err;
+    CHECK(rle::Encoder::write(f, img, mode, err));
+    std::vector<uint8_t> bytes(size_t(ftell(f)));
+    rewind(f);
+    CHECK(fread(bytes.data(), 1, bytes.size(), f) == bytes.size());
+    fclose(f);
+    return bytes;
+}
+
+// Helper: Decode through the FILE* path
+static rle::DecoderResult decode_file(const std::vector<uint8_t>& bytes, rle::Image& out) {
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    if (!bytes.empty()) CHECK(fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size());
+    rewind(f);
+    rle::DecoderResult res = rle::Decoder::read(f, out);
+    fclose(f);
+    return res;
+}
+
+static bool images_match(const rle::Image& a, const rle::Image& b) {
+    return a.header.width() == b.header.width() &&
+           a.header.height() == b.header.height() &&
+           a.header.channels() == b.header.channels() &&
+           a.pixels == b.pixels;
+}
+
+//==============================================================================
+// MEMORY DECODE TESTS
+//==============================================================================
+
+TEST(test_read_memory_matches_file) {
+    const bool alpha_modes[] = {false, true};
+    for (bool alpha : alpha_modes) {
+        rle::Image img = create_image(173, 61, alpha, {12, 34, 56});
+        fill_mixed(img, 7);
+        std::vector<uint8_t> bytes = encode_file(img, rle::Encoder::BG_OVERLAY);
+
+        rle::Image from_mem;
+        rle::DecoderResult res = rle::Decoder::read_memory(bytes.data(), bytes.size(), from_mem);
+        CHECK(res.ok);
+        CHECK(res.error == rle::Error::OK);
+        CHECK(images_match(img, from_mem));
+    }
+}
+
+TEST(test_read_memory_truncated) {
+    rle::Image img = create_image(64, 16);
+    fill_mixed(img, 3);
+    std::vector<uint8_t> bytes = encode_file(img);
+
+    // Every strict prefix must fail exactly as the FILE* decoder does
+    for (size_t len = 0; len < bytes.size(); len += (len < 64 ? 1 : 37)) {
+        rle::Image a, b;
+        rle::DecoderResult rm = rle::Decoder::read_memory(bytes.data(), len, a);
+        std::vector<uint8_t> prefix(bytes.begin(), bytes.begin() + len);
+        rle::DecoderResult rf = decode_file(prefix, b);
+        CHECK(rm.ok == rf.ok);
+        CHECK(rm.error == rf.error);
+        if (rm.ok) CHECK(a.pixels == b.pixels);
+    }
+}
+
+TEST(test_read_memory_bad_input) {
+    rle::Image out;
+    rle::DecoderResult res = rle::Decoder::read_memory(nullptr, 16, out);
+    CHECK(!res.ok);
+    CHECK(res.error == rle::Error::INTERNAL_ERROR);
+
+    const uint8_t junk[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77};
+    res = rle::Decoder::read_memory(junk, sizeof(junk), out);
+    CHECK(!res.ok);
+    CHECK(res.error == rle::Error::BAD_MAGIC);
+}
+
+//==============================================================================
+// MEMORY ENCODE TESTS
+//==============================================================================
+
+TEST(test_write_memory_vector_matches_file) {
+    const rle::Encoder::BackgroundMode modes[] = {
+        rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY, rle::Encoder::BG_CLEAR
+    };
+    for (rle::Encoder::BackgroundMode mode : modes) {
+        rle::Image img = create_image(300, 90, true, {12, 34, 56});
+        fill_mixed(img, 11);
+        std::vector<uint8_t> ref = encode_file(img, mode);
+
+        // Appends after existing contents
+        std::vector<uint8_t> out = {0xAA, 0xBB};
+        rle::Error err;
+        CHECK(rle::Encoder::write_memory(out, img, mode, err));
+        CHECK(err == rle::Error::OK);
+        CHECK(out.size() == ref.size() + 2);
+        CHECK(out[0] == 0xAA && out[1] == 0xBB);
+        CHECK(std::equal(ref.begin(), ref.end(), out.begin() + 2));
+    }
+}
+
+TEST(test_write_memory_fixed_buffer) {
+    rle::Image img = create_image(120, 40);
+    fill_mixed(img, 5);
+    std::vector<uint8_t> ref = encode_file(img);
+
+    // Exact fit succeeds
+    std::vector<uint8_t> buf(ref.size());
+    size_t written = 0;
+    rle::Error err;
+    CHECK(rle::Encoder::write_memory(buf.data(), buf.size(), written, img, rle::Encoder::BG_SAVE_ALL, err));
+    CHECK(written == ref.size());
+    CHECK(buf == ref);
+
+    // One byte short overflows, at any point in the stream
+    const size_t caps[] = {0, 5, ref.size() / 2, ref.size() - 1};
+    for (size_t cap : caps) {
+        std::vector<uint8_t> small(cap + 1);
+        CHECK(!rle::Encoder::write_memory(small.data(), cap, written, img, rle::Encoder::BG_SAVE_ALL, err));
+        CHECK(err == rle::Error::OUTPUT_OVERFLOW);
+        CHECK(written <= cap);
+    }
+}
+
+TEST(test_write_rgb_memory_matches_file) {
+    const uint32_t W = 97, H = 33;
+    std::vector<uint8_t> rgba(size_t(W) * H * 4);
+    uint32_t seed = 99;
+    for (size_t i = 0; i < rgba.size(); i++) {
+        seed = seed * 1103515245u + 12345u;
+        rgba[i] = (i / 4) % 5 ? uint8_t(seed >> 24) : 0;
+    }
+    std::vector<std::string> comments = {"SOFTWARE=test"};
+    std::vector<uint8_t> bg = {0, 0, 0};
+    rle::Error err;
+
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    CHECK(rle::write_rgb(f, rgba.data(), W, H, comments, bg, true, rle::Encoder::BG_OVERLAY, err));
+    std::vector<uint8_t> ref(size_t(ftell(f)));
+    rewind(f);
+    CHECK(fread(ref.data(), 1, ref.size(), f) == ref.size());
+    fclose(f);
+
+    std::vector<uint8_t> out;
+    CHECK(rle::write_rgb_memory(out, rgba.data(), W, H, comments, bg, true, rle::Encoder::BG_OVERLAY, err));
+    CHECK(out == ref);
+
+    std::vector<uint8_t> buf(ref.size() + 16);
+    size_t written = 0;
+    CHECK(rle::write_rgb_memory(buf.data(), buf.size(), written, rgba.data(), W, H,
+                                comments, bg, true, rle::Encoder::BG_OVERLAY, err));
+    CHECK(written == ref.size());
+    CHECK(std::equal(ref.begin(), ref.end(), buf.begin()));
+
+    CHECK(!rle::write_rgb_memory(buf.data(), 10, written, rgba.data(), W, H,
+                                 comments, bg, true, rle::Encoder::BG_OVERLAY, err));
+    CHECK(err == rle::Error::OUTPUT_OVERFLOW);
+}
+
+//==============================================================================
+// RGB CONVENIENCE TESTS
+//==============================================================================
+
+TEST(test_read_rgb_layouts) {
+    const uint8_t ncolors_list[] = {1, 2, 3, 5};
+    const bool alpha_modes[] = {false, true};
+    for (uint8_t nc : ncolors_list) {
+        for (bool alpha : alpha_modes) {
+            rle::Image img;
+            img.header.xlen = 45;
+            img.header.ylen = 12;
+            img.header.ncolors = nc;
+            img.header.pixelbits = 8;
+            if (alpha) img.header.flags |= rle::FLAG_ALPHA;
+            img.header.background.assign(nc, 4);
+            img.header.comments = {"A=b"};
+            img.header.flags |= rle::FLAG_COMMENT;
+            rle::Error err;
+            CHECK(img.allocate(err));
+            fill_mixed(img, nc * 10u + alpha);
+            std::vector<uint8_t> bytes = encode_file(img, rle::Encoder::BG_OVERLAY);
+            rle::Image dec;
+            CHECK(decode_file(bytes, dec).ok);
+
+            FILE* f = tmpfile();
+            CHECK(f != nullptr);
+            CHECK(fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size());
+            rewind(f);
+            std::vector<uint8_t> rgb(3, 1);
+            uint32_t w = 0, h = 0;
+            bool has_alpha = !alpha;
+            std::vector<std::string> comments;
+            CHECK(rle::read_rgb(f, rgb, w, h, &has_alpha, &comments, err));
+            CHECK(w == 45 && h == 12 && has_alpha == alpha);
+            CHECK(comments == img.header.comments);
+
+            const size_t chans = alpha ? 4 : 3;
+            CHECK(rgb.size() == size_t(w) * h * chans);
+            for (uint32_t y = 0; y < h; y++) {
+                for (uint32_t x = 0; x < w; x++) {
+                    const uint8_t* s = dec.pixel(x, y);
+                    const uint8_t* d = &rgb[(size_t(y) * w + x) * chans];
+                    for (uint8_t c = 0; c < 3; c++) CHECK(d[c] == (c < nc ? s[c] : 0));
+                    if (alpha) CHECK(d[3] == s[nc]);
+                }
+            }
+
+            rewind(f);
+            rle::Image out;
+            CHECK(rle::read_rgb(f, out, err));
+            CHECK(out.header.ncolors == 3 && out.header.has_alpha() == alpha);
+            CHECK(out.header.background == std::vector<uint8_t>({4, uint8_t(nc > 1 ? 4 : 0), uint8_t(nc > 2 ? 4 : 0)}));
+            CHECK(out.pixels == rgb);
+            if (nc == 3) CHECK(images_match(out, dec));
+            fclose(f);
+        }
+    }
+}
+
+//==============================================================================
+// IMAGE VIEW ENCODE TESTS
+//==============================================================================
+
+// Helper: Copy 'img' into a framebuffer with 'pad' extra bytes per pixel and
+// 'row_pad' per row, stored bottom-up if requested; returns the view of it
+static rle::ImageView make_framebuffer(const rle::Image& img, size_t pad, size_t row_pad,
+                                       bool bottom_up, std::vector<uint8_t>& fb) {
+    const uint32_t W = img.header.width(), H = img.header.height();
+    const size_t chans = img.header.channels();
+    const size_t pixel_stride = chans + pad;
+    const size_t pitch = size_t(W) * pixel_stride + row_pad;
+    fb.assign(pitch * H, 0xEE);
+    for (uint32_t y = 0; y < H; y++) {
+        uint8_t* row = fb.data() + pitch * (bottom_up ? H - 1 - y : y);
+        for (uint32_t x = 0; x < W; x++) std::memcpy(row + x * pixel_stride, img.pixel(x, y), chans);
+    }
+    const uint8_t* first = bottom_up ? fb.data() + pitch * (H - 1) : fb.data();
+    ptrdiff_t row_stride = bottom_up ? -ptrdiff_t(pitch) : ptrdiff_t(pitch);
+    return rle::ImageView(img.header, first, row_pad || bottom_up ? row_stride : 0, pad ? pixel_stride : 0);
+}
+
+TEST(test_image_view_matches_image) {
+    const bool alpha_modes[] = {false, true};
+    const size_t pads[] = {0, 1, 2};
+    const rle::Encoder::BackgroundMode modes[] = {
+        rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY, rle::Encoder::BG_CLEAR
+    };
+    for (bool alpha : alpha_modes) {
+        rle::Image img = create_image(75, 40, alpha, {5, 6, 7});
+        fill_mixed(img, 17 + alpha);
+        for (rle::Encoder::BackgroundMode mode : modes) {
+            const std::vector<uint8_t> ref = encode_file(img, mode);
+            for (size_t pad : pads) {
+                for (int layout = 0; layout < 3; layout++) {
+                    std::vector<uint8_t> fb;
+                    rle::ImageView view = make_framebuffer(img, pad, layout == 1 ? 13 : 0, layout == 2, fb);
+                    rle::Error err;
+                    std::vector<uint8_t> out;
+                    CHECK(rle::Encoder::write_memory(out, view, mode, err));
+                    CHECK(out == ref);
+                    out.clear();
+                    {
+                        rle::ByteSink sink(out);
+                        CHECK(rle::Encoder::write_parallel(sink, view, mode, 3, err));
+                    }
+                    CHECK(out == ref);
+                }
+            }
+            std::vector<uint8_t> fb;
+            rle::ImageView view = make_framebuffer(img, 1, 5, true, fb);
+            std::vector<uint8_t> out;
+            rle::Error err;
+            {
+                rle::ByteSink sink(out);
+                CHECK(rle::Encoder::write(sink, view, mode, rle::Encoder::MAX_COMPRESSION, err));
+            }
+            std::vector<uint8_t> ref_max;
+            {
+                rle::ByteSink sink(ref_max);
+                CHECK(rle::Encoder::write(sink, img, mode, rle::Encoder::MAX_COMPRESSION, err));
+            }
+            CHECK(out == ref_max);
+        }
+    }
+}
+
+TEST(test_image_view_file_and_errors) {
+    rle::Image img = create_image(33, 9, false, {1, 2, 3});
+    fill_mixed(img, 23);
+    std::vector<uint8_t> fb;
+    rle::ImageView view = make_framebuffer(img, 1, 0, true, fb);
+    rle::Error err;
+
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    CHECK(rle::Encoder::write(f, view, rle::Encoder::BG_OVERLAY, err));
+    std::vector<uint8_t> bytes(size_t(ftell(f)));
+    rewind(f);
+    CHECK(fread(bytes.data(), 1, bytes.size(), f) == bytes.size());
+    fclose(f);
+    CHECK(bytes == encode_file(img, rle::Encoder::BG_OVERLAY));
+
+    std::vector<uint8_t> out;
+    rle::ImageView bad = view;
+    bad.data = nullptr;
+    CHECK(!rle::Encoder::write_memory(out, bad, rle::Encoder::BG_OVERLAY, err));
+    CHECK(err == rle::Error::INTERNAL_ERROR);
+    CHECK(out.empty());
+    bad = view;
+    bad.pixel_stride = 2;
+    CHECK(!rle::Encoder::write_memory(out, bad, rle::Encoder::BG_OVERLAY, err));
+    CHECK(err == rle::Error::INTERNAL_ERROR);
+    CHECK(!rle::Encoder::write_parallel(static_cast<FILE*>(nullptr), view, rle::Encoder::BG_OVERLAY, 2, err));
+    CHECK(err == rle::Error::INTERNAL_ERROR);
+}
+
+//==============================================================================
+// MAPPED FILE DECODE TESTS
+//==============================================================================
+
+static void write_bytes(const char* path, const uint8_t* data, size_t len) {
+    FILE* f = fopen(path, "wb");
+    CHECK(f != nullptr);
+    if (len) CHECK(fwrite(data, 1, len, f) == len);
+    fclose(f);
+}
+
+TEST(test_read_file_matches_file) {
+    rle::Image img = create_image(211, 77, true, {1, 2, 3});
+    fill_mixed(img, 17);
+    std::vector<uint8_t> bytes = encode_file(img, rle::Encoder::BG_CLEAR);
+    const char* path = "test_extended_mapped.rle";
+    write_bytes(path, bytes.data(), bytes.size());
+
+    rle::Image out;
+    rle::DecoderResult res = rle::Decoder::read_file(path, out);
+    CHECK(res.ok);
+    CHECK(images_match(img, out));
+
+#ifdef RLE_HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    CHECK(fd >= 0);
+    rle::Image out_fd;
+    res = rle::Decoder::read_fd(fd, out_fd);
+    close(fd);
+    CHECK(res.ok);
+    CHECK(images_match(img, out_fd));
+#endif
+    remove(path);
+}
+
+TEST(test_read_file_truncated) {
+    rle::Image img = create_image(90, 20);
+    fill_mixed(img, 23);
+    std::vector<uint8_t> bytes = encode_file(img);
+    const char* path = "test_extended_truncated.rle";
+
+    const size_t lens[] = {0, 7, bytes.size() / 2, bytes.size() - 3};
+    for (size_t len : lens) {
+        write_bytes(path, bytes.data(), len);
+        rle::Image a, b;
+        rle::DecoderResult rm = rle::Decoder::read_file(path, a);
+        std::vector<uint8_t> prefix(bytes.begin(), bytes.begin() + len);
+        rle::DecoderResult rf = decode_file(prefix, b);
+        CHECK(rm.ok == rf.ok);
+        CHECK(rm.error == rf.error);
+    }
+    remove(path);
+
+    rle::Image out;
+    rle::DecoderResult res = rle::Decoder::read_file("no_such_file.rle", out);
+    CHECK(!res.ok);
+    CHECK(res.error == rle::Error::INTERNAL_ERROR);
+}
+
+//==============================================================================
+// STREAMING DECODE TESTS
+//==============================================================================
+
+TEST(test_read_rows_matches_image) {
+    const rle::Encoder::BackgroundMode modes[] = {
+        rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY, rle::Encoder::BG_CLEAR
+    };
+    const bool alpha_modes[] = {false, true};
+    for (rle::Encoder::BackgroundMode mode : modes) {
+        for (bool alpha : alpha_modes) {
+            rle::Image img = create_image(150, 45, alpha, {9, 8, 7});
+            fill_mixed(img, 31);
+            std::vector<uint8_t> bytes = encode_file(img, mode);
+
+            rle::Header h;
+            uint32_t expect_y = 0;
+            bool rows_ok = true;
+            rle::ByteSource src(bytes.data(), bytes.size());
+            rle::DecoderResult res = rle::Decoder::read_rows(src, h,
+                [&](uint32_t y, const uint8_t* row) {
+                    size_t len = size_t(h.width()) * h.channels();
+                    if (y != expect_y++ || std::memcmp(row, img.pixel(0, y), len) != 0)
+                        rows_ok = false;
+                });
+            CHECK(res.ok);
+            CHECK(rows_ok);
+            CHECK(expect_y == img.header.height());
+        }
+    }
+}
+
+TEST(test_read_rows_trailing_background) {
+    // Stream ends (EOF opcode) before the last rows; they arrive as background
+    rle::Image img = create_image(20, 10, false, {40, 50, 60});
+    for (uint32_t y = 0; y < 4; y++)
+        for (uint32_t x = 0; x < 20; x++)
+            img.pixel(x, y)[0] = uint8_t(x * y);
+    std::vector<uint8_t> bytes = encode_file(img, rle::Encoder::BG_OVERLAY);
+
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    CHECK(fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size());
+    rewind(f);
+    rle::Header h;
+    uint32_t rows = 0;
+    bool rows_ok = true;
+    rle::DecoderResult res = rle::Decoder::read_rows(f, h, [&](uint32_t y, const uint8_t* row) {
+        ++rows;
+        if (std::memcmp(row, img.pixel(0, y), 60) != 0) rows_ok = false;
+    });
+    fclose(f);
+    CHECK(res.ok);
+    CHECK(rows_ok);
+    CHECK(rows == 10);
+}
+
+TEST(test_read_rows_truncated) {
+    rle::Image img = create_image(64, 32);
+    fill_mixed(img, 41);
+    std::vector<uint8_t> bytes = encode_file(img);
+
+    rle::Image ref;
+    rle::DecoderResult rf = rle::Decoder::read_memory(bytes.data(), bytes.size() / 2, ref);
+    CHECK(!rf.ok);
+
+    rle::Header h;
+    uint32_t rows = 0;
+    rle::ByteSource src(bytes.data(), bytes.size() / 2);
+    rle::DecoderResult res = rle::Decoder::read_rows(src, h, [&](uint32_t, const uint8_t*) { ++rows; });
+    CHECK(!res.ok);
+    CHECK(res.error == rf.error);
+    CHECK(rows < img.header.height());
+}
+
+//==============================================================================
+// STREAMING ENCODE TESTS
+//==============================================================================
+
+TEST(test_stream_encoder_matches_encoder) {
+    const rle::Encoder::BackgroundMode modes[] = {
+        rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY, rle::Encoder::BG_CLEAR
+    };
+    for (rle::Encoder::BackgroundMode mode : modes) {
+        rle::Image img = create_image(128, 70, false, {5, 6, 7});
+        fill_mixed(img, 53);
+        // Long background stretch to exercise SKIP_LINES coalescing
+        for (uint32_t y = 20; y < 60; y++)
+            for (uint32_t x = 0; x < 128; x++)
+                std::memcpy(img.pixel(x, y), img.header.background.data(), 3);
+        img.header.comments = {"SOFTWARE=stream"};
+        std::vector<uint8_t> ref = encode_file(img, mode);
+
+        std::vector<uint8_t> out;
+        rle::Error err;
+        {
+            rle::StreamEncoder enc(out);
+            CHECK(enc.begin(img.header, mode, err));
+            for (uint32_t y = 0; y < img.header.height(); y++) {
+                // Hand over a transient copy: the encoder must not keep pointers
+                std::vector<uint8_t> row(img.pixel(0, y), img.pixel(0, y) + 128 * 3);
+                CHECK(enc.push_row(row.data(), err));
+            }
+            CHECK(enc.rows_pushed() == img.header.height());
+            CHECK(enc.finish(err));
+        }
+        CHECK(out == ref);
+    }
+}
+
+TEST(test_stream_encoder_file) {
+    rle::Image img = create_image(33, 12, true);
+    fill_mixed(img, 59);
+    std::vector<uint8_t> ref = encode_file(img);
+
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    rle::Error err;
+    {
+        rle::StreamEncoder enc(f);
+        CHECK(enc.begin(img.header, rle::Encoder::BG_SAVE_ALL, err));
+        for (uint32_t y = 0; y < img.header.height(); y++)
+            CHECK(enc.push_row(img.pixel(0, y), err));
+        CHECK(enc.finish(err));
+    }
+    std::vector<uint8_t> bytes(size_t(ftell(f)));
+    rewind(f);
+    CHECK(fread(bytes.data(), 1, bytes.size(), f) == bytes.size());
+    fclose(f);
+    CHECK(bytes == ref);
+}
+
+TEST(test_stream_encoder_misuse) {
+    rle::Image img = create_image(8, 2);
+    std::vector<uint8_t> out;
+    rle::Error err;
+    rle::StreamEncoder enc(out);
+
+    CHECK(!enc.push_row(img.pixel(0, 0), err));          // before begin()
+    CHECK(err == rle::Error::INTERNAL_ERROR);
+    CHECK(enc.begin(img.header, rle::Encoder::BG_SAVE_ALL, err));
+    CHECK(enc.push_row(img.pixel(0, 0), err));
+    CHECK(!enc.finish(err));                              // one row short
+    CHECK(enc.push_row(img.pixel(0, 1), err));
+    CHECK(!enc.push_row(img.pixel(0, 1), err));          // one row too many
+    CHECK(enc.finish(err));
+    CHECK(!enc.finish(err));                              // already finished
+}
+
+//==============================================================================
+// PARALLEL ENCODE TESTS
+//==============================================================================
+
+TEST(test_write_parallel_matches_serial) {
+    const uint32_t heights[] = {1, 17, 64, 301};
+    const unsigned thread_counts[] = {0, 1, 2, 3, 8};
+    const rle::Encoder::BackgroundMode modes[] = {
+        rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY, rle::Encoder::BG_CLEAR
+    };
+    for (uint32_t H : heights) {
+        rle::Image img = create_image(90, H, false, {3, 2, 1});
+        fill_mixed(img, H);
+        // Background stretch straddling several band boundaries
+        for (uint32_t y = H / 4; y < H * 3 / 4; y++)
+            for (uint32_t x = 0; x < 90; x++)
+                std::memcpy(img.pixel(x, y), img.header.background.data(), 3);
+        for (rle::Encoder::BackgroundMode mode : modes) {
+            std::vector<uint8_t> ref = encode_file(img, mode);
+            for (unsigned threads : thread_counts) {
+                std::vector<uint8_t> out;
+                rle::Error err;
+                {
+                    rle::ByteSink sink(out);
+                    CHECK(rle::Encoder::write_parallel(sink, img, mode, threads, err));
+                }
+                CHECK(out == ref);
+            }
+        }
+    }
+}
+
+TEST(test_write_parallel_file) {
+    rle::Image img = create_image(256, 200, true);
+    fill_mixed(img, 61);
+    std::vector<uint8_t> ref = encode_file(img);
+
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    rle::Error err;
+    CHECK(rle::Encoder::write_parallel(f, img, rle::Encoder::BG_SAVE_ALL, 4, err));
+    std::vector<uint8_t> bytes(size_t(ftell(f)));
+    rewind(f);
+    CHECK(fread(bytes.data(), 1, bytes.size(), f) == bytes.size());
+    fclose(f);
+    CHECK(bytes == ref);
+}
+
+//==============================================================================
+// PARALLEL DECODE TESTS
+//==============================================================================
+
+TEST(test_read_parallel_matches_serial) {
+    const unsigned thread_counts[] = {0, 1, 2, 5};
+    const rle::Encoder::BackgroundMode modes[] = {
+        rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY, rle::Encoder::BG_CLEAR
+    };
+    const bool alpha_modes[] = {false, true};
+    for (rle::Encoder::BackgroundMode mode : modes) {
+        for (bool alpha : alpha_modes) {
+            rle::Image img = create_image(140, 123, alpha, {4, 5, 6});
+            fill_mixed(img, 67);
+            for (uint32_t y = 30; y < 80; y++)
+                for (uint32_t x = 0; x < 140; x++)
+                    std::memcpy(img.pixel(x, y), img.header.background.data(), 3);
+            std::vector<uint8_t> bytes = encode_file(img, mode);
+            for (unsigned threads : thread_counts) {
+                rle::Image out;
+                rle::DecoderResult res = rle::Decoder::read_memory_parallel(bytes.data(), bytes.size(), out, threads);
+                CHECK(res.ok);
+                CHECK(images_match(img, out));
+            }
+        }
+    }
+}
+
+TEST(test_read_parallel_errors) {
+    rle::Image img = create_image(80, 40);
+    fill_mixed(img, 71);
+    std::vector<uint8_t> bytes = encode_file(img);
+
+    for (size_t len = 0; len < bytes.size(); len += 53) {
+        rle::Image a, b;
+        rle::DecoderResult rs = rle::Decoder::read_memory(bytes.data(), len, a);
+        rle::DecoderResult rp = rle::Decoder::read_memory_parallel(bytes.data(), len, b, 3);
+        CHECK(rs.ok == rp.ok);
+        CHECK(rs.error == rp.error);
+        CHECK(a.pixels == b.pixels);
+    }
+
+    // A stream cut inside the body keeps the rows decoded before the cut
+    {
+        rle::Image a, b;
+        const size_t len = bytes.size() * 2 / 3;
+        rle::DecoderResult rs = rle::Decoder::read_memory(bytes.data(), len, a);
+        rle::DecoderResult rp = rle::Decoder::read_memory_parallel(bytes.data(), len, b, 4);
+        CHECK(!rp.ok);
+        CHECK(rs.error == rp.error);
+        CHECK(a.pixels == b.pixels);
+        CHECK(memcmp(b.pixel(0, 0), img.pixel(0, 0), img.header.width() * 3) == 0);
+    }
+
+    // Corrupt an opcode mid-stream: the pre-scan must reject it
+    std::vector<uint8_t> bad = bytes;
+    bad[bad.size() / 2] = 0x3F;
+    bad[bad.size() / 2 + 1] = 0x3F;
+    rle::Image a, b;
+    rle::DecoderResult rs = rle::Decoder::read_memory(bad.data(), bad.size(), a);
+    rle::DecoderResult rp = rle::Decoder::read_memory_parallel(bad.data(), bad.size(), b, 4);
+    CHECK(rs.ok == rp.ok);
+    CHECK(rs.error == rp.error);
+    CHECK(a.pixels == b.pixels);
+}
+
+TEST(test_read_file_parallel) {
+    rle::Image img = create_image(200, 150, true, {9, 9, 9});
+    fill_mixed(img, 73);
+    std::vector<uint8_t> bytes = encode_file(img, rle::Encoder::BG_OVERLAY);
+    const char* path = "test_extended_parallel.rle";
+    write_bytes(path, bytes.data(), bytes.size());
+    rle::Image out;
+    rle::DecoderResult res = rle::Decoder::read_file_parallel(path, out, 4);
+    remove(path);
+    CHECK(res.ok);
+    CHECK(images_match(img, out));
+}
+
+//==============================================================================
+// ROW INDEX TESTS
+//==============================================================================
+
+// Helper: Encode with an embedded row index into memory
+static std::vector<uint8_t> encode_indexed(const rle::Image& img, rle::Encoder::BackgroundMode mode,
+                                           uint32_t step) {
+    std::vector<uint8_t> bytes;
+    rle::Error err;
+    {
+        rle::ByteSink out(bytes);
+        CHECK(rle::Encoder::write_indexed(out, img, mode, step, err));
+        CHECK(out.flush());
+    }
+    return bytes;
+}
+
+// Helper: Decode rows [y0, y1) and check them against the source image
+static void check_range(const std::vector<uint8_t>& bytes, const rle::Image& img,
+                        uint32_t y0, uint32_t y1) {
+    const size_t row_bytes = size_t(img.header.width()) * img.header.channels();
+    uint32_t expect = y0;
+    rle::Header h;
+    rle::ByteSource src(bytes.data(), bytes.size());
+    rle::DecoderResult res = rle::Decoder::read_row_range(src, h, y0, y1,
+        [&](uint32_t y, const uint8_t* row) {
+            CHECK(y == expect);
+            CHECK(memcmp(row, img.pixel(0, y), row_bytes) == 0);
+            expect++;
+        });
+    CHECK(res.ok);
+    CHECK(expect == std::min(y1, img.header.height()) || y0 >= y1);
+}
+
+TEST(test_indexed_legacy_decode) {
+    rle::Image img = create_image(97, 130, false, {40, 50, 60});
+    fill_mixed(img, 5);
+    std::vector<uint8_t> bytes = encode_indexed(img, rle::Encoder::BG_OVERLAY, 16);
+
+    rle::Image out;
+    CHECK(decode_file(bytes, out).ok);
+    CHECK(images_match(img, out));
+
+    rle::RowIndex index;
+    CHECK(index.parse(out.header));
+    CHECK(index.step == 16);
+    CHECK(index.offset.size() == (130 + 15) / 16);
+
+    // Re-encoding with write_indexed replaces the old table
+    std::vector<uint8_t> again = encode_indexed(out, rle::Encoder::BG_SAVE_ALL, 32);
+    rle::Image reread;
+    CHECK(decode_file(again, reread).ok);
+    CHECK(images_match(img, reread));
+    size_t tables = 0;
+    for (const std::string& c : reread.header.comments)
+        tables += c.compare(0, strlen(rle::RowIndex::key()), rle::RowIndex::key()) == 0;
+    CHECK(tables == 1);
+    CHECK(index.parse(reread.header));
+    CHECK(index.step == 32);
+}
+
+// Helper: Replace the body of indexed file 'bytes' with 'body_of' (another
+// encode of the same pixels), keeping the header and so the stale index
+static std::vector<uint8_t> splice_body(const std::vector<uint8_t>& bytes,
+                                        const std::vector<uint8_t>& body_of) {
+    rle::Header h;
+    rle::Endian e;
+    rle::Error err;
+    rle::ByteSource a(bytes.data(), bytes.size()), b(body_of.data(), body_of.size());
+    CHECK(rle::read_header_auto(a, h, e, err));
+    CHECK(rle::read_header_auto(b, h, e, err));
+    std::vector<uint8_t> out(bytes.begin(), bytes.begin() + size_t(a.tell()));
+    out.insert(out.end(), body_of.begin() + size_t(b.tell()), body_of.end());
+    return out;
+}
+
+TEST(test_stale_index_falls_back) {
+    rle::Image img = create_image(90, 160, false, {1, 2, 3});
+    fill_mixed(img, 29);
+    for (uint32_t y = 50; y < 95; y++)
+        for (uint32_t x = 0; x < 90; x++) memcpy(img.pixel(x, y), img.header.background.data(), 3);
+    std::vector<uint8_t> indexed = encode_indexed(img, rle::Encoder::BG_OVERLAY, 8);
+    rle::Image decoded;
+    CHECK(decode_file(indexed, decoded).ok);
+
+    // Encoder::write keeps comments, so the decoded image's table rides
+    // along into bodies it does not describe
+    std::vector<std::vector<uint8_t>> stale;
+    const rle::Encoder::BackgroundMode modes[] = {
+        rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY, rle::Encoder::BG_CLEAR
+    };
+    for (rle::Encoder::BackgroundMode mode : modes) {
+        stale.push_back(encode_file(decoded, mode));
+        std::vector<uint8_t> best;
+        rle::Error err;
+        {
+            rle::ByteSink sink(best);
+            CHECK(rle::Encoder::write(sink, decoded, mode, rle::Encoder::MAX_COMPRESSION, err));
+        }
+        stale.push_back(best);
+    }
+    // Same header and table, other body, plus trailing bytes
+    std::vector<uint8_t> spliced = splice_body(indexed, encode_file(img, rle::Encoder::BG_SAVE_ALL));
+    spliced.push_back(0);
+    stale.push_back(spliced);
+
+    for (const std::vector<uint8_t>& bytes : stale) {
+        rle::Image out;
+        CHECK(decode_file(bytes, out).ok);
+        CHECK(images_match(img, out));
+        rle::RowIndex index;
+        CHECK(index.parse(out.header));
+        for (uint32_t y0 = 0; y0 < 160; y0 += 13) check_range(bytes, img, y0, y0 + 20);
+    }
+
+    // FILE sources verify through seeks as well
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    CHECK(fwrite(spliced.data(), 1, spliced.size(), f) == spliced.size());
+    rewind(f);
+    rle::Header h;
+    uint32_t expect = 100;
+    CHECK(rle::Decoder::read_row_range(f, h, 100, 120, [&](uint32_t y, const uint8_t* row) {
+        CHECK(y == expect++);
+        CHECK(memcmp(row, img.pixel(0, y), 90 * 3) == 0);
+    }).ok);
+    CHECK(expect == 120);
+    fclose(f);
+}
+
+// Helper: Offset of the opcode body in 'bytes' and its header
+static size_t body_offset(const std::vector<uint8_t>& bytes, rle::Header& h) {
+    rle::Endian e;
+    rle::Error err;
+    rle::ByteSource src(bytes.data(), bytes.size());
+    CHECK(rle::read_header_auto(src, h, e, err));
+    return size_t(src.tell());
+}
+
+// Helper: 'bytes' with its RowIndex comment replaced by 'index', sealed
+// over the body as it now stands (as if the writer had produced it)
+static std::vector<uint8_t> reseal_index(const std::vector<uint8_t>& bytes, rle::RowIndex index) {
+    rle::Header h;
+    const size_t body = body_offset(bytes, h);
+    index.seal(bytes.data() + body);
+    for (std::string& c : h.comments)
+        if (c.compare(0, strlen(rle::RowIndex::key()), rle::RowIndex::key()) == 0) c = index.to_comment();
+    std::vector<uint8_t> out;
+    {
+        rle::ByteSink sink(out);
+        CHECK(rle::write_header(sink, rle::Encoder::stream_header(h, rle::Encoder::BG_SAVE_ALL)));
+        CHECK(sink.flush());
+    }
+    out.insert(out.end(), bytes.begin() + body, bytes.end());
+    return out;
+}
+
+TEST(test_index_targets_checked) {
+    // Every row starts with SET_COLOR 0; an index shifted off the row
+    // starts (body length and hashes still right) must not be followed
+    rle::Image img = create_image(70, 64);
+    fill_mixed(img, 31);
+    std::vector<uint8_t> bytes = encode_indexed(img, rle::Encoder::BG_SAVE_ALL, 8);
+    rle::Header h;
+    body_offset(bytes, h);
+    rle::RowIndex index;
+    CHECK(index.parse(h));
+    for (size_t k = 1; k < index.offset.size(); k++) index.offset[k] += 2;
+    std::vector<uint8_t> shifted = reseal_index(bytes, index);
+    for (uint32_t y0 = 0; y0 < 64; y0 += 5) check_range(shifted, img, y0, 64);
+}
+
+TEST(test_index_rejects_edited_body) {
+    // Runs of one value between bands of background rows, so the body is
+    // a sequence of 16-bit words with no stray SKIP_LINES patterns
+    rle::Image img = create_image(40, 96, false, {0, 0, 0});
+    for (uint32_t y = 0; y < 96; y++)
+        if (y % 12 < 3)
+            for (uint32_t x = 0; x < 40; x++) memset(img.pixel(x, y), 0x40 + int(y % 12), 3);
+    std::vector<uint8_t> bytes = encode_indexed(img, rle::Encoder::BG_OVERLAY, 16);
+    rle::Header h;
+    const size_t body = body_offset(bytes, h);
+    rle::RowIndex index;
+    CHECK(index.parse(h));
+
+    // Skip one more line in the first band: same length, same opcode at
+    // every entry, but every later scanline moves down by one
+    size_t at = 0;
+    for (size_t i = body; i < body + index.offset[1]; i += 2)
+        if (bytes[i] == 1 && bytes[i + 1] >= 2) { at = i; break; }
+    CHECK(at != 0);
+    std::vector<uint8_t> edited = bytes;
+    edited[at + 1]++;
+    rle::Image moved;
+    CHECK(decode_file(edited, moved).ok);
+    CHECK(!images_match(img, moved));
+    for (uint32_t y0 = 16; y0 < 96; y0 += 7) check_range(edited, moved, y0, 96);
+
+    // A run value changed in place inside the target band
+    edited = bytes;
+    edited[body + index.offset[3] + 4] ^= 0x11;
+    CHECK(decode_file(edited, moved).ok);
+    CHECK(!images_match(img, moved));
+    check_range(edited, moved, 48, 60);
+}
+
+TEST(test_indexed_row_ranges) {
+    rle::Image img = create_image(80, 200, false, {1, 2, 3});
+    fill_mixed(img, 11);
+    for (uint32_t y = 40; y < 110; y++)                 // long SKIP_LINES run
+        for (uint32_t x = 0; x < 80; x++) memcpy(img.pixel(x, y), img.header.background.data(), 3);
+    std::vector<uint8_t> bytes = encode_indexed(img, rle::Encoder::BG_OVERLAY, 8);
+
+    const uint32_t ranges[][2] = {{0, 200}, {0, 1}, {57, 63}, {64, 72}, {100, 150}, {199, 200},
+                                  {150, 500}, {30, 30}};
+    for (const auto& r : ranges) check_range(bytes, img, r[0], r[1]);
+}
+
+TEST(test_indexed_coarsens_to_fit) {
+    rle::Image img = create_image(4, 32000);
+    fill_mixed(img, 13);
+    std::vector<uint8_t> bytes = encode_indexed(img, rle::Encoder::BG_SAVE_ALL, 1);
+
+    rle::Image out;
+    CHECK(decode_file(bytes, out).ok);
+    CHECK(images_match(img, out));
+    CHECK(rle::pack_comments(out.header.comments).size() <= rle::MAX_COMMENT_LEN);
+    rle::RowIndex index;
+    CHECK(index.parse(out.header));
+    CHECK(index.step > 1);
+    check_range(bytes, img, 25000, 25010);
+}
+
+TEST(test_indexed_short_image) {
+    // Shorter than RowIndex::DEFAULT_STEP: the default step shrinks to
+    // leave a second band, and an explicit step is clamped to the height
+    rle::Image img = create_image(50, 40);
+    fill_mixed(img, 23);
+    std::vector<uint8_t> bytes = encode_indexed(img, rle::Encoder::BG_SAVE_ALL, 0);
+    rle::Header h;
+    const size_t body = body_offset(bytes, h);
+    rle::RowIndex index;
+    CHECK(index.parse(h));
+    CHECK(index.step == 32 && index.offset.size() == 2);
+
+    // The second band is sought to: scribble over the first (resealed)
+    for (size_t i = body; i < body + index.offset[1]; i++) bytes[i] = 0xFF;
+    bytes = reseal_index(bytes, index);
+    rle::Image full;
+    rle::DecoderResult res = decode_file(bytes, full);
+    CHECK(!res.ok || !images_match(img, full));
+    check_range(bytes, img, 33, 40);
+
+    bytes = encode_indexed(img, rle::Encoder::BG_SAVE_ALL, 64);
+    rle::Header clamped;
+    body_offset(bytes, clamped);
+    CHECK(index.parse(clamped));
+    CHECK(index.step == 40 && index.offset.size() == 1);
+    CHECK(!index.coarsen(40));
+
+    // Coarsening stops at the height instead of doubling past it
+    bytes = encode_indexed(img, rle::Encoder::BG_SAVE_ALL, 24);
+    rle::Header coarse;
+    body_offset(bytes, coarse);
+    CHECK(index.parse(coarse));
+    CHECK(index.step == 24 && index.coarsen(40));
+    CHECK(index.step == 40 && !index.coarsen(40));
+}
+
+TEST(test_row_range_without_index) {
+    rle::Image img = create_image(64, 90, true, {7, 7, 7});
+    fill_mixed(img, 17);
+    std::vector<uint8_t> bytes = encode_file(img, rle::Encoder::BG_OVERLAY);
+    check_range(bytes, img, 33, 61);
+}
+
+TEST(test_row_range_seeks_past_earlier_rows) {
+    rle::Image img = create_image(120, 96);
+    fill_mixed(img, 19);
+    std::vector<uint8_t> bytes = encode_indexed(img, rle::Encoder::BG_SAVE_ALL, 32);
+
+    rle::Header h;
+    rle::Endian e;
+    rle::Error err;
+    rle::ByteSource src(bytes.data(), bytes.size());
+    CHECK(rle::read_header_auto(src, h, e, err));
+    rle::RowIndex index;
+    CHECK(index.parse(h));
+
+    // Scribble over the opcodes of the first two bands and seal the table
+    // over the result; a reader that honours the index hashes those bytes
+    // but never decodes them
+    const size_t body = size_t(src.tell());
+    for (size_t i = body; i < body + index.offset[2]; i++) bytes[i] = 0xFF;
+    bytes = reseal_index(bytes, index);
+    rle::Image full;
+    rle::DecoderResult res = decode_file(bytes, full);
+    CHECK(!res.ok || !images_match(img, full));
+    check_range(bytes, img, 64, 96);
+}
+
+//==============================================================================
+// REGION DECODE TESTS
+//==============================================================================
+
+// Helper: True if 'win' equals the [x0,x1) x [y0,y1) crop of 'img'
+static bool window_matches(const rle::Image& img, const rle::Image& win,
+                           uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    const uint8_t chans = img.header.channels();
+    if (win.header.width() != x1 - x0 || win.header.height() != y1 - y0 ||
+        win.header.channels() != chans || win.pixels.size() != size_t(x1 - x0) * (y1 - y0) * chans)
+        return false;
+    for (uint32_t y = y0; y < y1; y++)
+        if (memcmp(win.pixel(0, y - y0), img.pixel(x0, y), size_t(x1 - x0) * chans) != 0) return false;
+    return true;
+}
+
+TEST(test_read_region_matches_crop) {
+    const bool alpha_modes[] = {false, true};
+    for (bool alpha : alpha_modes) {
+        rle::Image img = create_image(150, 90, alpha, {20, 30, 40});
+        fill_mixed(img, 23);
+        std::vector<uint8_t> bytes = encode_file(img, rle::Encoder::BG_OVERLAY);
+
+        const uint32_t windows[][4] = {{0, 0, 150, 90}, {10, 5, 60, 40}, {37, 0, 38, 90},
+                                       {0, 89, 150, 90}, {100, 70, 150, 90}, {149, 3, 150, 4}};
+        for (const auto& w : windows) {
+            rle::Image win;
+            rle::DecoderResult res = rle::Decoder::read_region_memory(bytes.data(), bytes.size(),
+                                                                      w[0], w[1], w[2], w[3], win);
+            CHECK(res.ok);
+            CHECK(window_matches(img, win, w[0], w[1], w[2], w[3]));
+            CHECK(win.header.xpos == img.header.xpos + w[0]);
+            CHECK(win.header.ypos == img.header.ypos + w[1]);
+        }
+    }
+}
+
+TEST(test_read_region_clips_and_rejects) {
+    rle::Image img = create_image(64, 48);
+    fill_mixed(img, 29);
+    std::vector<uint8_t> bytes = encode_file(img);
+
+    rle::Image win;
+    CHECK(rle::Decoder::read_region_memory(bytes.data(), bytes.size(), 50, 40, 1000, 1000, win).ok);
+    CHECK(window_matches(img, win, 50, 40, 64, 48));
+
+    CHECK(!rle::Decoder::read_region_memory(bytes.data(), bytes.size(), 10, 10, 10, 20, win).ok);
+    CHECK(!rle::Decoder::read_region_memory(bytes.data(), bytes.size(), 64, 0, 80, 10, win).ok);
+
+    // Truncation inside the window is still reported
+    rle::DecoderResult res = rle::Decoder::read_region_memory(bytes.data(), bytes.size() - 40,
+                                                              0, 0, 64, 48, win);
+    CHECK(!res.ok);
+    CHECK(res.error == rle::Error::TRUNCATED_OPCODE);
+
+    // A window whose placement would wrap the 16-bit position is refused
+    rle::Image far = create_image(64, 48);
+    fill_mixed(far, 31);
+    far.header.xpos = 65500;
+    far.header.ypos = 65510;
+    std::vector<uint8_t> far_bytes = encode_file(far);
+    res = rle::Decoder::read_region_memory(far_bytes.data(), far_bytes.size(), 35, 0, 64, 10, win);
+    CHECK(res.ok);
+    CHECK(win.header.xpos == 65535);
+    res = rle::Decoder::read_region_memory(far_bytes.data(), far_bytes.size(), 36, 0, 64, 10, win);
+    CHECK(!res.ok);
+    CHECK(res.error == rle::Error::DIM_TOO_LARGE);
+    res = rle::Decoder::read_region_memory(far_bytes.data(), far_bytes.size(), 0, 26, 64, 48, win);
+    CHECK(!res.ok);
+    CHECK(res.error == rle::Error::DIM_TOO_LARGE);
+}
+
+TEST(test_read_region_indexed_file) {
+    rle::Image img = create_image(120, 160, false, {5, 6, 7});
+    fill_mixed(img, 31);
+    std::vector<uint8_t> bytes = encode_indexed(img, rle::Encoder::BG_OVERLAY, 16);
+
+    FILE* f = tmpfile();
+    CHECK(f != nullptr);
+    CHECK(fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size());
+    rewind(f);
+    rle::Image win;
+    rle::DecoderResult res = rle::Decoder::read_region(f, 30, 100, 90, 140, win);
+    fclose(f);
+    CHECK(res.ok);
+    CHECK(window_matches(img, win, 30, 100, 90, 140));
+}
+
+TEST(test_read_region_stale_index) {
+    rle::Image img = create_image(120, 160, false, {5, 6, 7});
+    fill_mixed(img, 37);
+    for (uint32_t y = 20; y < 70; y++)
+        for (uint32_t x = 0; x < 120; x++) memcpy(img.pixel(x, y), img.header.background.data(), 3);
+    rle::Image decoded;
+    CHECK(decode_file(encode_indexed(img, rle::Encoder::BG_OVERLAY, 16), decoded).ok);
+
+    // Re-encoded with the old table still in the comments
+    const rle::Encoder::BackgroundMode modes[] = {rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_CLEAR};
+    const uint32_t windows[][4] = {{30, 100, 90, 140}, {0, 33, 120, 70}, {5, 150, 6, 160}};
+    for (rle::Encoder::BackgroundMode mode : modes) {
+        std::vector<uint8_t> bytes = encode_file(decoded, mode);
+        rle::RowIndex index;
+        CHECK(index.parse(decoded.header));
+        for (const auto& w : windows) {
+            rle::Image win;
+            CHECK(rle::Decoder::read_region_memory(bytes.data(), bytes.size(), w[0], w[1], w[2], w[3], win).ok);
+            CHECK(window_matches(img, win, w[0], w[1], w[2], w[3]));
+
+            FILE* f = tmpfile();
+            CHECK(f != nullptr);
+            CHECK(fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size());
+            rewind(f);
+            rle::Image fwin;
+            CHECK(rle::Decoder::read_region(f, w[0], w[1], w[2], w[3], fwin).ok);
+            fclose(f);
+            CHECK(window_matches(img, fwin, w[0], w[1], w[2], w[3]));
+        }
+    }
+}
+
+//==============================================================================
+// SCANNING KERNEL TESTS
+//==============================================================================
+
+TEST(test_scan_kernels_match_scalar) {
+    uint32_t seed = 37;
+    std::vector<uint8_t> buf(300);
+    for (int iter = 0; iter < 4000; iter++) {
+        // Short alphabets give runs and triples at every offset
+        const uint32_t n = 1 + (iter % 299);
+        const uint32_t alphabet = 1 + (iter % 4);
+        for (uint32_t i = 0; i < n; i++) {
+            seed = seed * 1103515245u + 12345u;
+            buf[i] = uint8_t((seed >> 16) % alphabet);
+        }
+        if (iter % 5 == 0) memset(buf.data(), 9, n - n / 3);   // long leading run
+
+        uint32_t run = 1;
+        while (run < n && buf[run] == buf[0]) run++;
+        CHECK(rle::scan_run(buf.data(), n) == run);
+
+        uint32_t triple = n;
+        for (uint32_t i = 0; i + 2 < n; i++)
+            if (buf[i] == buf[i + 1] && buf[i + 1] == buf[i + 2]) { triple = i; break; }
+        CHECK(rle::scan_triple(buf.data(), n) == triple);
+    }
+}
+
+TEST(test_deinterleave_row_matches_scalar) {
+    uint32_t seed = 41;
+    for (uint8_t chans = 1; chans <= 5; chans++) {
+        for (size_t stride = chans; stride <= size_t(chans) + 2; stride++) {
+            for (uint32_t w = 1; w <= 70; w++) {
+                std::vector<uint8_t> row(size_t(w) * stride), planes(size_t(w) * chans);
+                for (auto& b : row) { seed = seed * 1103515245u + 12345u; b = uint8_t(seed >> 16); }
+                rle::deinterleave_row(row.data(), w, chans, planes.data(), stride);
+                for (uint8_t c = 0; c < chans; c++)
+                    for (uint32_t x = 0; x < w; x++)
+                        CHECK(planes[size_t(c) * w + x] == row[size_t(x) * stride + c]);
+            }
+        }
+    }
+}
+
+TEST(test_match_background_matches_scalar) {
+    uint32_t seed = 67;
+    const uint8_t bg[] = {4, 5, 6, 7};
+    for (uint8_t ncolors = 1; ncolors <= 4; ncolors++) {
+        for (uint32_t w = 1; w <= 80; w++) {
+            std::vector<uint8_t> planes(size_t(w) * ncolors), mask(w);
+            for (uint8_t c = 0; c < ncolors; c++)
+                for (uint32_t x = 0; x < w; x++) {
+                    seed = seed * 1103515245u + 12345u;
+                    // Mostly background, with sparse single-channel mismatches
+                    planes[size_t(c) * w + x] = ((seed >> 16) % 23 == 0) ? uint8_t(bg[c] + 1) : bg[c];
+                }
+            bool all = true;
+            bool got_all = rle::match_background(planes.data(), w, ncolors, bg, mask.data());
+            for (uint32_t x = 0; x < w; x++) {
+                bool match = true;
+                for (uint8_t c = 0; c < ncolors; c++) match = match && planes[size_t(c) * w + x] == bg[c];
+                CHECK(mask[x] == (match ? 0xFF : 0));
+                all = all && match;
+            }
+            CHECK(got_all == all);
+        }
+    }
+}
+
+//==============================================================================
+// PLANAR DECODE TESTS
+//==============================================================================
+
+// Helper: True if the planes hold exactly the channels of 'img'
+static bool planes_match(const rle::Image& img, const rle::PlanarImage& pl) {
+    const uint8_t chans = img.header.channels();
+    if (pl.header.width() != img.header.width() || pl.header.height() != img.header.height() ||
+        pl.header.channels() != chans || pl.planes.size() != img.pixels.size())
+        return false;
+    for (uint32_t y = 0; y < img.header.height(); y++)
+        for (uint32_t x = 0; x < img.header.width(); x++)
+            for (uint8_t c = 0; c < chans; c++)
+                if (pl.row(c, y)[x] != img.pixel(x, y)[c]) return false;
+    return true;
+}
+
+TEST(test_read_planar_matches_interleaved) {
+    const bool alpha_modes[] = {false, true};
+    const rle::Encoder::BackgroundMode modes[] = {rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY};
+    for (bool alpha : alpha_modes) {
+        for (auto mode : modes) {
+            rle::Image img = create_image(131, 47, alpha, {90, 80, 70});
+            fill_mixed(img, 43);
+            std::vector<uint8_t> bytes = encode_file(img, mode);
+
+            rle::PlanarImage pl;
+            rle::DecoderResult res = rle::Decoder::read_planar_memory(bytes.data(), bytes.size(), pl);
+            CHECK(res.ok);
+            CHECK(planes_match(img, pl));
+
+            FILE* f = tmpfile();
+            CHECK(f != nullptr);
+            CHECK(fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size());
+            rewind(f);
+            rle::PlanarImage from_file;
+            res = rle::Decoder::read_planar(f, from_file);
+            fclose(f);
+            CHECK(res.ok);
+            CHECK(from_file.planes == pl.planes);
+        }
+    }
+}
+
+TEST(test_read_planar_truncated) {
+    rle::Image img = create_image(64, 30, true, {1, 2, 3});
+    fill_mixed(img, 47);
+    std::vector<uint8_t> bytes = encode_file(img, rle::Encoder::BG_OVERLAY);
+    for (size_t cut : {size_t(5), bytes.size() / 2, bytes.size() - 3}) {
+        rle::Image ref;
+        rle::DecoderResult want = rle::Decoder::read_memory(bytes.data(), cut, ref);
+        rle::PlanarImage pl;
+        rle::DecoderResult got = rle::Decoder::read_planar_memory(bytes.data(), cut, pl);
+        CHECK(got.ok == want.ok);
+        CHECK(got.error == want.error);
+        if (!ref.pixels.empty()) CHECK(planes_match(ref, pl));
+    }
+}
+
+//==============================================================================
+// MAX COMPRESSION ENCODE TESTS
+//==============================================================================
+
+// Helper: Encode with an explicit opcode strategy into memory
+static std::vector<uint8_t> encode_strategy(const rle::Image& img, rle::Encoder::BackgroundMode mode,
+                                            rle::Encoder::Strategy strategy) {
+    std::vector<uint8_t> bytes;
+    rle::Error err;
+    {
+        rle::ByteSink out(bytes);
+        CHECK(rle::Encoder::write(out, img, mode, strategy, err));
+        CHECK(out.flush());
+    }
+    return bytes;
+}
+
+TEST(test_max_compression_roundtrip_and_size) {
+    const bool alpha_modes[] = {false, true};
+    const rle::Encoder::BackgroundMode modes[] = {rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY,
+                                                  rle::Encoder::BG_CLEAR};
+    for (bool alpha : alpha_modes) {
+        for (auto mode : modes) {
+            rle::Image img = create_image(301, 57, alpha, {60, 60, 60});
+            fill_mixed(img, 53);
+            // Short runs and pairs that the greedy parse handles poorly
+            for (uint32_t x = 0; x < 301; x++) img.pixel(x, 10)[1] = uint8_t((x / 3) % 2 ? 5 : x);
+            std::vector<uint8_t> greedy = encode_strategy(img, mode, rle::Encoder::GREEDY);
+            std::vector<uint8_t> best = encode_strategy(img, mode, rle::Encoder::MAX_COMPRESSION);
+            CHECK(best.size() <= greedy.size());
+
+            rle::Image out;
+            CHECK(decode_file(best, out).ok);
+            CHECK(images_match(img, out));
+        }
+    }
+}
+
+TEST(test_max_compression_filler_and_long_forms) {
+    // Runs of exactly 3 inside noise cost the greedy parse a RUN_DATA plus
+    // a fresh literal header; long runs and literals cross into the 16-bit
+    // operand forms
+    rle::Image img = create_image(2000, 3, false, {0, 0, 0});
+    uint32_t seed = 59;
+    for (uint32_t x = 0; x < 2000; x++) {
+        seed = seed * 1103515245u + 12345u;
+        img.pixel(x, 0)[0] = uint8_t(seed >> 16);
+        img.pixel(x, 0)[1] = (x % 13 < 10) ? uint8_t(x * 7) : 200;
+        img.pixel(x, 0)[2] = (x < 1500) ? 9 : uint8_t(seed >> 20);
+        img.pixel(x, 1)[0] = (x > 100 && x < 1900) ? 0 : 1;
+    }
+    std::vector<uint8_t> greedy = encode_strategy(img, rle::Encoder::BG_OVERLAY, rle::Encoder::GREEDY);
+    std::vector<uint8_t> best = encode_strategy(img, rle::Encoder::BG_OVERLAY, rle::Encoder::MAX_COMPRESSION);
+    CHECK(best.size() < greedy.size());
+
+    rle::Image out;
+    CHECK(decode_file(best, out).ok);
+    CHECK(images_match(img, out));
+}
+
+// Reference for the MAX_COMPRESSION parse: the fewest bytes one channel of
+// a row can take, trying every opcode length from every position.
+// SKIP_PIXELS costs 2 bytes (4 past 255 pixels), RUN_DATA 4 (6 past 256),
+// BYTE_DATA 2 (4 past 256) plus the bytes and a filler when the count is
+// odd.  Background at the end of the row is free, and a channel after the
+// first that is all background drops its SET_COLOR.
+static uint64_t brute_force_channel_bytes(const uint8_t* plane, const uint8_t* bg, uint32_t W, bool first) {
+    std::vector<bool> tail_bg(W + 1, bg != nullptr);
+    for (uint32_t i = W; i-- > 0; ) tail_bg[i] = tail_bg[i + 1] && bg[i];
+    std::vector<uint64_t> cost(W + 1, 0);
+    for (uint32_t i = W; i-- > 0; ) {
+        if (tail_bg[i]) continue;
+        uint64_t best = ~uint64_t(0);
+        bool same = true, skip = bg != nullptr;
+        for (uint32_t k = i + 1; k <= W; k++) {
+            const uint32_t n = k - i;
+            same = same && plane[k - 1] == plane[i];
+            skip = skip && bg[k - 1];
+            if (skip && n <= 65535) best = std::min(best, (n > 255 ? 4 : 2) + cost[k]);
+            if (same && n <= 65536) best = std::min(best, (n > 256 ? 6 : 4) + cost[k]);
+            if (n <= 65536) best = std::min(best, (n > 256 ? 4 : 2) + n + (n & 1) + cost[k]);
+        }
+        cost[i] = best;
+    }
+    return (!first && tail_bg[0]) ? 0 : 2 + cost[0];
+}
+
+TEST(test_max_compression_matches_brute_force) {
+    // Short random rows of background spans, runs and literals over a few
+    // values, so ties, pairs and odd literal lengths all come up; a few
+    // rows are long enough for the 16-bit operand forms
+    const std::vector<uint8_t> bg_color = {7, 7, 7};
+    const rle::Encoder::BackgroundMode modes[] = {rle::Encoder::BG_SAVE_ALL, rle::Encoder::BG_OVERLAY};
+    uint32_t seed = 71;
+    auto next = [&seed](uint32_t mod) {
+        seed = seed * 1103515245u + 12345u;
+        return (seed >> 8) % mod;
+    };
+    for (int iter = 0; iter < 240; iter++) {
+        const uint32_t W = iter % 24 == 0 ? 257 + next(500) : 1 + next(90);
+        const bool alpha = iter % 3 == 2;
+        rle::Image img = create_image(W, 1, alpha, bg_color);
+        const uint8_t chans = img.header.channels();
+        for (uint32_t x = 0; x < W; ) {
+            uint32_t len = 1 + (next(8) == 0 ? next(300) : next(6));
+            uint32_t kind = next(3);
+            uint8_t value[4];
+            for (uint8_t c = 0; c < chans; c++) value[c] = uint8_t(next(2) ? 7 : next(4));
+            for (; len > 0 && x < W; len--, x++) {
+                uint8_t* p = img.pixel(x, 0);
+                for (uint8_t c = 0; c < chans; c++) {
+                    if (kind == 0) p[c] = 7;                      // background
+                    else if (kind == 1) p[c] = value[c];          // run
+                    else p[c] = uint8_t(next(3) ? next(4) : 7);   // literal
+                }
+            }
+        }
+
+        for (auto mode : modes) {
+            const rle::Header h = rle::Encoder::stream_header(img.header, mode);
+            rle::Encoder::Scratch scratch;
+            rle::Encoder::stage_row(h, img.pixel(0, 0), mode, rle::Encoder::MAX_COMPRESSION, scratch);
+            std::vector<uint8_t> bytes;
+            rle::Error err;
+            {
+                rle::ByteSink out(bytes);
+                CHECK(rle::Encoder::encode_row(out, h, rle::Encoder::MAX_COMPRESSION, scratch, err));
+                CHECK(out.flush());
+            }
+
+            std::vector<uint8_t> plane(W), bg(W);
+            for (uint32_t x = 0; x < W; x++) bg[x] = memcmp(img.pixel(x, 0), bg_color.data(), 3) == 0;
+            uint64_t want = 0;
+            for (uint8_t c = 0; c < chans; c++) {
+                for (uint32_t x = 0; x < W; x++) plane[x] = img.pixel(x, 0)[c];
+                const bool can_skip = mode != rle::Encoder::BG_SAVE_ALL && c < 3;
+                want += brute_force_channel_bytes(plane.data(), can_skip ? bg.data() : nullptr, W, c == 0);
+            }
+            if (bytes.size() != want) {
+                fprintf(stderr, "\nWidth %u mode %d: parse took %zu bytes, brute force %llu\n", W, int(mode),
+                        bytes.size(), (unsigned long long)want);
+                exit(1);
+            }
+        }
+    }
+}
+
+TEST(test_max_compression_stream_encoder) {
+    rle::Image img = create_image(90, 40, true, {1, 1, 1});
+    fill_mixed(img, 61);
+    std::vector<uint8_t> whole = encode_strategy(img, rle::Encoder::BG_OVERLAY, rle::Encoder::MAX_COMPRESSION);
+
+    std::vector<uint8_t> streamed;
+    rle::Error err;
+    {
+        rle::StreamEncoder enc(streamed);
+        enc.set_strategy(rle::Encoder::MAX_COMPRESSION);
+        CHECK(enc.begin(img.header, rle::Encoder::BG_OVERLAY, err));
+        for (uint32_t y = 0; y < img.header.height(); y++) CHECK(enc.push_row(img.pixel(0, y), err));
+        CHECK(enc.finish(err));
+    }
+    CHECK(streamed == whole);
+}
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+int main() {
+    printf("=== RLE Extended API Test Suite ===\n");
+
+    printf("\n--- Memory Decode Tests ---\n");
+    test_read_memory_matches_file_wrapper();
+    test_read_memory_truncated_wrapper();
+    test_read_memory_bad_input_wrapper();
+
+    printf("\n--- Memory Encode Tests ---\n");
+    test_write_memory_vector_matches_file_wrapper();
+    test_write_memory_fixed_buffer_wrapper();
+    test_write_rgb_memory_matches_file_wrapper();
+
+    printf("\n--- RGB Convenience Tests ---\n");
+    test_read_rgb_layouts_wrapper();
+
+    printf("\n--- Image View Encode Tests ---\n");
+    test_image_view_matches_image_wrapper();
+    test_image_view_file_and_errors_wrapper();
+
+    printf("\n--- Mapped File Decode Tests ---\n");
+    test_read_file_matches_file_wrapper();
+    test_read_file_truncated_wrapper();
+
+    printf("\n--- Streaming Decode Tests ---\n");
+    test_read_rows_matches_image_wrapper();
+    test_read_rows_trailing_background_wrapper();
+    test_read_rows_truncated_wrapper();
+
+    printf("\n--- Streaming Encode Tests ---\n");
+    test_stream_encoder_matches_encoder_wrapper();
+    test_stream_encoder_file_wrapper();
+    test_stream_encoder_misuse_wrapper();
+
+    printf("\n--- Parallel Encode Tests ---\n");
+    test_write_parallel_matches_serial_wrapper();
+    test_write_parallel_file_wrapper();
+
+    printf("\n--- Parallel Decode Tests ---\n");
+    test_read_parallel_matches_serial_wrapper();
+    test_read_parallel_errors_wrapper();
+    test_read_file_parallel_wrapper();
+
+    printf("\n--- Row Index Tests ---\n");
+    test_indexed_legacy_decode_wrapper();
+    test_indexed_row_ranges_wrapper();
+    test_stale_index_falls_back_wrapper();
+    test_index_targets_checked_wrapper();
+    test_index_rejects_edited_body_wrapper();
+    test_indexed_coarsens_to_fit_wrapper();
+    test_indexed_short_image_wrapper();
+    test_row_range_without_index_wrapper();
+    test_row_range_seeks_past_earlier_rows_wrapper();
+
+    printf("\n--- Region Decode Tests ---\n");
+    test_read_region_matches_crop_wrapper();
+    test_read_region_clips_and_rejects_wrapper();
+    test_read_region_indexed_file_wrapper();
+    test_read_region_stale_index_wrapper();
+
+    printf("\n--- Scanning Kernel Tests ---\n");
+    test_scan_kernels_match_scalar_wrapper();
+    test_deinterleave_row_matches_scalar_wrapper();
+    test_match_background_matches_scalar_wrapper();
+
+    printf("\n--- Planar Decode Tests ---\n");
+    test_read_planar_matches_interleaved_wrapper();
+    test_read_planar_truncated_wrapper();
+
+    printf("\n--- Max Compression Encode Tests ---\n");
+    test_max_compression_roundtrip_and_size_wrapper();
+    test_max_compression_filler_and_long_forms_wrapper();
+    test_max_compression_matches_brute_force_wrapper();
+    test_max_compression_stream_encoder_wrapper();
+
+    printf("\n=== Results ===\n");
+    printf("Tests passed: %d/%d\n", tests_passed, tests_run);
+
+    if (tests_passed == tests_run) {
+        printf("\n✅ All extended API tests PASSED\n");
+        return 0;
+    } else {
+        printf("\n❌ Some tests FAILED\n");
+        return 1;
+    }
+}
@@ -8,6 +8,7 @@
  */
 
 #include "rle.hpp"
+#include "rle_internal.hpp"
 #include <iostream>
 #include <vector>
 #include <cstdlib>
@@ -17,10 +18,6 @@
 
 // No external dependencies - self-contained tests
 
-// Declare external functions from rle.cpp
-int rle_write(icv_image_t *bif, FILE *fp);
-icv_image_t* rle_read(FILE *fp);
-
 // Test statistics
 static int tests_passed = 0;
 static int tests_failed = 0;
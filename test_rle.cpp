@@ -7,6 +7,7 @@
  */
 
 #include "rle.hpp"
+#include "rle_internal.hpp"
 #include <iostream>
 #include <cassert>
 #include <cstring>
@@ -14,11 +15,8 @@
 #include <vector>
 #include <algorithm>
 #include <cstdio>
-
-// Declare external functions from rle.cpp
-int rle_write(icv_image_t *bif, FILE *fp);
-icv_image_t* rle_read(FILE *fp);
-void bu_free(void *ptr, const char *str);
+#include <cmath>
+#include <limits>
 
 // Test result tracking
 struct TestStats {
@@ -647,6 +645,170 @@ void test_teapot_image() {
     END_TEST();
 }
 
+// Test: Vectorized double -> u8 conversion matches the scalar lrint path
+void test_quantize_matches_lrint() {
+    TEST("Double to 8-bit conversion matches scalar lrint");
+
+    // Values straddling every rounding midpoint (k + 0.5) / 255 by a few
+    // ulps, out-of-range and special values, and random data
+    std::vector<double> src;
+    for (int k = 0; k < 256; k++) {
+        double v = (k + 0.5) / 255.0;
+        src.push_back(v);
+        double up = v, down = v;
+        for (int u = 0; u < 3; u++) {
+            up = std::nextafter(up, 2.0);
+            down = std::nextafter(down, -1.0);
+            src.push_back(up);
+            src.push_back(down);
+        }
+        src.push_back(k / 255.0);
+    }
+    const double specials[] = {0.0, -0.0, 1.0, -1e-300, 1e-300, 1.0000001, -5.0, 7.0, 0.5,
+                               std::numeric_limits<double>::infinity(),
+                               -std::numeric_limits<double>::infinity(),
+                               std::numeric_limits<double>::quiet_NaN()};
+    for (double v : specials) src.push_back(v);
+    uint32_t seed = 4242;
+    for (int i = 0; i < 5000; i++) {
+        seed = seed * 1103515245u + 12345u;
+        src.push_back(-0.1 + 1.2 * (seed >> 8) / double(1u << 24));
+    }
+
+    std::vector<uint8_t> expected(src.size());
+    for (size_t i = 0; i < src.size(); i++) {
+        double v = src[i];
+        if (v < 0.0) v = 0.0;
+        if (v > 1.0) v = 1.0;
+        expected[i] = static_cast<uint8_t>(lrint(v * 255.0));
+    }
+
+    // Every start offset and a ragged length cover the vector bodies and
+    // scalar tails at all alignments
+    std::vector<uint8_t> got(src.size());
+    for (size_t off = 0; off < 17; off++) {
+        size_t n = src.size() - off - (off % 5);
+        std::fill(got.begin(), got.end(), uint8_t(0xAA));
+        rle_quantize_u8(src.data() + off, got.data() + off, n);
+        EXPECT_TRUE(std::equal(got.begin() + off, got.begin() + off + n, expected.begin() + off));
+        EXPECT_TRUE(off + n == got.size() || got[off + n] == 0xAA);
+    }
+
+    END_TEST();
+}
+
+// Test: Decoded values are exactly byte / 255.0 for every byte value
+void test_expand_exact_levels() {
+    TEST("Decoded doubles are exact 8-bit levels");
+
+    const size_t channel_counts[] = {3, 4};
+    for (size_t channels : channel_counts) {
+        icv_image_t* img = create_test_image(256, 3, channels);
+        EXPECT_TRUE(img != nullptr);
+        if (!img) continue;
+        for (size_t i = 0; i < 256 * 3 * channels; i++)
+            img->data[i] = double((i * 7 + i / channels) % 256) / 255.0;
+
+        FILE* fp = tmpfile();
+        EXPECT_TRUE(fp != nullptr);
+        if (!fp) { free_test_image(img); continue; }
+        EXPECT_EQ(rle_write(img, fp), 0);
+        rewind(fp);
+        icv_image_t* back = rle_read(fp);
+        fclose(fp);
+
+        EXPECT_TRUE(back != nullptr);
+        if (back) {
+            EXPECT_EQ(back->channels, channels);
+            bool exact = true;
+            for (size_t i = 0; i < 256 * 3 * channels; i++)
+                if (back->data[i] != img->data[i]) exact = false;
+            EXPECT_TRUE(exact);
+            free_test_image(back);
+        }
+        free_test_image(img);
+    }
+
+    // Buffers past 32 MiB of output take the streaming-store path; check
+    // it at both 16-byte alignments of the destination and a ragged tail
+    const size_t n = (size_t(4) << 20) + 37;
+    std::vector<uint8_t> bytes(n);
+    for (size_t i = 0; i < n; i++) bytes[i] = uint8_t(i * 131 + i / 256);
+    std::vector<double> out(n + 1);
+    for (size_t off = 0; off < 2; off++) {
+        std::fill(out.begin(), out.end(), -1.0);
+        rle_expand_u8(bytes.data(), out.data() + off, n - off);
+        bool exact = true;
+        for (size_t i = 0; i < n - off; i++)
+            if (out[off + i] != double(bytes[i]) / 255.0) exact = false;
+        EXPECT_TRUE(exact);
+        EXPECT_TRUE(out[n] == -1.0);
+    }
+
+    END_TEST();
+}
+
+// Test: rle_read of codec-written files matches Decoder::read, including
+// background prefill, skipped rows, alpha and non-RGB channel counts
+void test_read_matches_decoder() {
+    TEST("rle_read matches the 8-bit decoder");
+
+    const uint8_t ncolor_cases[] = {3, 1, 5};
+    for (uint8_t ncolors : ncolor_cases) {
+        for (int alpha = 0; alpha < 2; alpha++) {
+            rle::Image src;
+            src.header.xlen = 37;
+            src.header.ylen = 21;
+            src.header.ncolors = ncolors;
+            src.header.pixelbits = 8;
+            if (alpha) src.header.flags |= rle::FLAG_ALPHA;
+            for (uint8_t c = 0; c < ncolors; c++) src.header.background.push_back(uint8_t(40 + 30 * c));
+            rle::Error err;
+            EXPECT_TRUE(src.allocate(err));
+            for (uint32_t y = 0; y < 21; y++) {
+                if (y % 4 == 1) continue;                   // background rows
+                for (uint32_t x = 5; x < 30; x++)
+                    for (uint8_t c = 0; c < src.header.channels(); c++)
+                        src.pixel(x, y)[c] = uint8_t((x * 13 + y * 7 + c * 50) & 0xFF);
+            }
+
+            FILE* fp = tmpfile();
+            EXPECT_TRUE(fp != nullptr);
+            if (!fp) continue;
+            EXPECT_TRUE(rle::Encoder::write(fp, src, rle::Encoder::BG_OVERLAY, err));
+            rewind(fp);
+            rle::Image ref;
+            EXPECT_TRUE(rle::Decoder::read(fp, ref).ok);
+            rewind(fp);
+            icv_image_t* img = rle_read(fp);
+            fclose(fp);
+
+            EXPECT_TRUE(img != nullptr);
+            if (!img) continue;
+            size_t chans = alpha ? 4 : 3;
+            EXPECT_EQ(img->channels, chans);
+            EXPECT_EQ(img->alpha_channel, size_t(alpha));
+            bool same = true;
+            for (uint32_t y = 0; y < 21; y++) {
+                for (uint32_t x = 0; x < 37; x++) {
+                    for (size_t c = 0; c < chans; c++) {
+                        // RGB from the first three colour channels (0 where
+                        // the file has fewer), then alpha
+                        double want = 0.0;
+                        if (c == 3) want = ref.pixel(x, y)[ncolors] / 255.0;
+                        else if (c < ncolors) want = ref.pixel(x, y)[c] / 255.0;
+                        if (img->data[(size_t(y) * 37 + x) * chans + c] != want) same = false;
+                    }
+                }
+            }
+            EXPECT_TRUE(same);
+            free_test_image(img);
+        }
+    }
+
+    END_TEST();
+}
+
 int main() {
     std::cout << "========================================\n";
     std::cout << "RLE Implementation Test Suite\n";
@@ -684,6 +846,12 @@ int main() {
     // Reference image test
     std::cout << "\n--- Reference Image Tests ---\n";
     test_teapot_image();
+
+    // Pixel conversion tests
+    std::cout << "\n--- Conversion Tests ---\n";
+    test_quantize_matches_lrint();
+    test_expand_exact_levels();
+    test_read_matches_decoder();
     
     // Print summary
     g_stats.print_summary();
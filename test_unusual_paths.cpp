@@ -6,15 +6,19 @@
  * - Long form opcodes (runs/skips > 255 pixels)
  * - Large uniform regions
  * - Extended skip operations
+ * - rle.cpp background detection decisions
  *
  * These are not error cases but legitimate optimizations and extended
  * format features that should be tested for completeness.
  */
 
 #include "rle.hpp"
+#include "rle_internal.hpp"
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <unordered_map>
+#include <vector>
 
 static int tests_run = 0;
 static int tests_passed = 0;
@@ -409,6 +413,40 @@ TEST(test_long_byte_data) {
     }
 }
 
+TEST(test_long_literal_single_opcode) {
+    // A 1000-pixel span with no run of 3 is emitted as one long-form
+    // BYTE_DATA (operand 999) rather than four 256-byte literals
+    rle::Image img = create_image(1000, 2);
+    for (uint32_t y = 0; y < img.header.height(); y++) {
+        for (uint32_t x = 0; x < img.header.width(); x++) {
+            img.pixel(x, y)[0] = ((x / 2) % 2) ? 0 : 255;
+            img.pixel(x, y)[1] = uint8_t(x * 7);
+            img.pixel(x, y)[2] = uint8_t(x * 13 + y);
+        }
+    }
+
+    std::vector<uint8_t> bytes;
+    rle::Error err;
+    if (!rle::Encoder::write_memory(bytes, img, rle::Encoder::BG_SAVE_ALL, err)) {
+        fprintf(stderr, "Write failed: %s\n", rle::error_string(err));
+        exit(1);
+    }
+    const uint8_t op[] = {rle::OPC_BYTE_DATA | rle::OPC_LONG_FLAG, 0, 999 & 0xFF, 999 >> 8};
+    size_t found = 0;
+    for (size_t i = 0; i + sizeof(op) <= bytes.size(); i++)
+        if (memcmp(bytes.data() + i, op, sizeof(op)) == 0) found++;
+    if (found != 6) {
+        fprintf(stderr, "Expected 6 long BYTE_DATA opcodes, found %zu\n", found);
+        exit(1);
+    }
+
+    rle::Image out;
+    if (!roundtrip(img, out) || !images_match(img, out)) {
+        fprintf(stderr, "Roundtrip failed\n");
+        exit(1);
+    }
+}
+
 //==============================================================================
 // COMBINED TESTS
 //==============================================================================
@@ -513,6 +551,155 @@ TEST(test_rgba_with_long_runs) {
     }
 }
 
+//==============================================================================
+// STREAM POSITION TESTS
+//==============================================================================
+
+TEST(test_concatenated_streams) {
+    // Two images back to back in one FILE. The buffered reader pulls ahead
+    // in large blocks, so decoding the first image must leave the stream
+    // positioned exactly at the start of the second one.
+    rle::Image a = create_image(300, 200);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < a.pixels.size(); i++) {
+        seed = seed * 1103515245u + 12345u;
+        a.pixels[i] = uint8_t(seed >> 16);
+    }
+    rle::Image b = create_image(40, 30);
+    for (uint32_t y = 0; y < b.header.height(); y++)
+        for (uint32_t x = 0; x < b.header.width(); x++)
+            b.pixel(x, y)[y % 3] = uint8_t(x * 6);
+
+    const char* filename = "test_concatenated.rle";
+    FILE* f = fopen(filename, "wb");
+    if (!f) exit(1);
+    rle::Error err;
+    if (!rle::Encoder::write(f, a, rle::Encoder::BG_SAVE_ALL, err)) exit(1);
+    long split = ftell(f);
+    if (!rle::Encoder::write(f, b, rle::Encoder::BG_SAVE_ALL, err)) exit(1);
+    fclose(f);
+
+    f = fopen(filename, "rb");
+    if (!f) exit(1);
+    rle::Image out_a, out_b;
+    auto ra = rle::Decoder::read(f, out_a);
+    long pos = ftell(f);
+    auto rb = rle::Decoder::read(f, out_b);
+    fclose(f);
+    remove(filename);
+
+    if (!ra.ok || !rb.ok) {
+        fprintf(stderr, "Read failed\n");
+        exit(1);
+    }
+    if (pos != split) {
+        fprintf(stderr, "Stream position %ld after first image, expected %ld\n", pos, split);
+        exit(1);
+    }
+    if (!images_match(a, out_a) || !images_match(b, out_b)) {
+        fprintf(stderr, "Images don't match\n");
+        exit(1);
+    }
+}
+
+//==============================================================================
+// BACKGROUND DETECTION TESTS
+//==============================================================================
+
+// Reference: the unordered_map histogram rle.cpp used originally
+static rle::Encoder::BackgroundMode reference_detect(const std::vector<uint8_t>& rgb, size_t npix,
+                                                     uint8_t color[3]) {
+    uint64_t clear_needed = uint64_t(npix * 0.50);
+    uint64_t overlay_needed = uint64_t(npix * 0.20);
+    std::unordered_map<uint32_t, uint64_t> freq;
+    rle::Encoder::BackgroundMode mode = rle::Encoder::BG_SAVE_ALL;
+    uint64_t max_count = 0;
+    uint32_t max_key = 0;
+    for (size_t i = 0; i < npix; i++) {
+        uint32_t key = (uint32_t(rgb[3*i]) << 16) | (uint32_t(rgb[3*i + 1]) << 8) | rgb[3*i + 2];
+        auto it = freq.find(key);
+        if (it == freq.end()) {
+            if (freq.size() >= 65536) return mode;
+            it = freq.emplace(key, 1).first;
+        } else {
+            ++it->second;
+        }
+        if (it->second > max_count) {
+            max_count = it->second;
+            max_key = key;
+            if (max_count >= clear_needed || (max_count >= overlay_needed && mode != rle::Encoder::BG_OVERLAY)) {
+                color[0] = uint8_t(max_key >> 16);
+                color[1] = uint8_t(max_key >> 8);
+                color[2] = uint8_t(max_key);
+                if (max_count >= clear_needed) return rle::Encoder::BG_CLEAR;
+                mode = rle::Encoder::BG_OVERLAY;
+            }
+        }
+    }
+    if (mode == rle::Encoder::BG_SAVE_ALL && max_count >= overlay_needed) {
+        color[0] = uint8_t(max_key >> 16);
+        color[1] = uint8_t(max_key >> 8);
+        color[2] = uint8_t(max_key);
+        mode = rle::Encoder::BG_OVERLAY;
+    }
+    return mode;
+}
+
+TEST(test_detect_background_matches_reference) {
+    // Palettes of varying size and skew, including images that cross the
+    // 65536 unique colour cap before and after an overlay color is chosen
+    uint32_t seed = 777;
+    for (int iter = 0; iter < 60; iter++) {
+        seed = seed * 1103515245u + 12345u;
+        size_t w = 1 + (seed >> 8) % 400, h = 1 + (seed >> 20) % 300;
+        if (iter % 10 == 0) { w = 300; h = 300; }
+        size_t npix = w * h;
+        uint32_t palette = (iter % 3 == 0) ? 0x1000000u : 1u + (seed >> 4) % 4000;
+        uint32_t bias = (seed >> 12) % 100;
+        std::vector<uint8_t> rgb(npix * 3);
+        uint32_t prev = 0;
+        for (size_t i = 0; i < npix; i++) {
+            seed = seed * 1103515245u + 12345u;
+            uint32_t key;
+            if ((seed >> 16) % 100 < bias) key = (i < npix * 3 / 4) ? 0x102030u : 0x405060u;
+            else if ((seed >> 10) % 4 == 0) key = prev;
+            else key = (seed * 2654435761u) % palette;
+            prev = key;
+            rgb[3*i] = uint8_t(key >> 16);
+            rgb[3*i + 1] = uint8_t(key >> 8);
+            rgb[3*i + 2] = uint8_t(key);
+        }
+        uint8_t got[3] = {0, 0, 0}, want[3] = {0, 0, 0};
+        rle::Encoder::BackgroundMode a = rle_detect_background(rgb.data(), w, h, got);
+        rle::Encoder::BackgroundMode b = reference_detect(rgb, npix, want);
+        if (a != b || memcmp(got, want, 3) != 0) {
+            fprintf(stderr, "Decision mismatch at iteration %d (%d vs %d)\n", iter, int(a), int(b));
+            exit(1);
+        }
+    }
+}
+
+TEST(test_detect_background_unique_cap) {
+    // 200000 pixels: n distinct colors, then a dominant color for the rest.
+    // With 65535 leading colors the dominant one is the 65536th and fits;
+    // with 65536 it is one too many and detection gives up.
+    const size_t npix = 200000;
+    const size_t counts[] = {65535, 65536};
+    for (size_t n : counts) {
+        std::vector<uint8_t> rgb(npix * 3, 7);
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t key = i * 251u;
+            rgb[3*i] = uint8_t(key >> 16);
+            rgb[3*i + 1] = uint8_t(key >> 8);
+            rgb[3*i + 2] = uint8_t(key);
+        }
+        uint8_t color[3] = {0, 0, 0};
+        rle::Encoder::BackgroundMode mode = rle_detect_background(rgb.data(), 400, 500, color);
+        if (n == 65535 && (mode != rle::Encoder::BG_CLEAR || color[0] != 7 || color[2] != 7)) exit(1);
+        if (n == 65536 && mode != rle::Encoder::BG_SAVE_ALL) exit(1);
+    }
+}
+
 //==============================================================================
 // MAIN
 //==============================================================================
@@ -533,11 +720,21 @@ int main() {
     test_long_skip_pixels_wrapper();
     test_long_skip_lines_wrapper();
     test_long_byte_data_wrapper();
+    test_long_literal_single_opcode_wrapper();
     
     // Combined tests
     printf("\n--- Combined Feature Tests ---\n");
     test_combined_long_and_background_wrapper();
     test_rgba_with_long_runs_wrapper();
+
+    // Stream position tests
+    printf("\n--- Stream Position Tests ---\n");
+    test_concatenated_streams_wrapper();
+
+    // Background detection tests
+    printf("\n--- Background Detection Tests ---\n");
+    test_detect_background_matches_reference_wrapper();
+    test_detect_background_unique_cap_wrapper();
     
     printf("\n=== Results ===\n");
     printf("Tests passed: %d/%d\n", tests_passed, tests_run);